@@ -35,7 +35,11 @@ string sym_from_id(uint64_t token_id, string prefix) {
   }
 }
 
-void oswaps::save_transaction(name entry, uint64_t token_id) {
+void oswaps::save_transaction(name entry, uint64_t token_id, name pool) {
+  save_transaction(entry, std::vector<uint64_t>{ token_id }, pool);
+}
+
+void oswaps::save_transaction(name entry, const std::vector<uint64_t>& token_ids, name pool) {
   auto size = transaction_size();
   //printf("saved tx, size %ld ", size);
   char *   buffer = (char *)(512 < size ? malloc(size) : alloca(size));
@@ -43,21 +47,26 @@ void oswaps::save_transaction(name entry, uint64_t token_id) {
   check(size == read, "read_transaction failed");
   transaction trx = unpack<transaction>(buffer, size);  
   // validation on trx.actions
-  //   check that the last action transfers the right token to oswaps
-  //   check that the next-to-last action is oswaps `entry` action
-  assetsa assettable(get_self(), get_self().value);
-  auto a = assettable.require_find(token_id, "unrecog token id");  
-  auto final_action = trx.actions.back();
-  check(final_action.name == "transfer"_n,
-    "final action must be token transfer");
-  transfer_params tp = unpack<transfer_params>(final_action.data.data(), final_action.data.size());
-  check(tp.to==get_self() && tp.quantity.symbol.code()==a->symbol
-    && final_action.account == a->contract_name,
-    "token transfer parameters don't match prep");
-  action should_be_this_action = *(trx.actions.rbegin()+1);
+  //   check that the last actions transfer the right tokens to oswaps, in order
+  //   check that the action before them is oswaps `entry` action
+  check(!get_pool(pool).frozen, "pool is frozen");
+  assetsa assettable(get_self(), pool.value);
+  size_t legs = token_ids.size();
+  check(trx.actions.size() > legs, "prep action must precede the token transfers");
+  for (size_t i = 0; i < legs; ++i) {
+    auto a = assettable.require_find(token_ids[i], "unrecog token id");  
+    const action& transfer_action = trx.actions[trx.actions.size() - legs + i];
+    check(transfer_action.name == "transfer"_n,
+      "final actions must be token transfers");
+    transfer_params tp = unpack<transfer_params>(transfer_action.data.data(), transfer_action.data.size());
+    check(tp.to==get_self() && tp.quantity.symbol.code()==a->symbol
+      && transfer_action.account == a->contract_name,
+      "token transfer parameters don't match prep");
+  }
+  const action& should_be_this_action = trx.actions[trx.actions.size() - legs - 1];
   check(should_be_this_action.name == entry
     && should_be_this_action.account == get_self(),
-    "prep action must be next-to-last in transaction ");
+    "prep action must precede the token transfers in transaction ");
   // save serialized transaction to txx singleton
   std::string data(buffer, size);
   txx txset(get_self(), get_self().value);
@@ -66,6 +75,9 @@ void oswaps::save_transaction(name entry, uint64_t token_id) {
   }  
   txtemp tx;
   tx.txdata = data;
+  if (legs > 1) {
+    tx.legs_done = 0;
+  }
   txset.set(tx, get_self());
   return;
 
@@ -74,12 +86,53 @@ void oswaps::save_transaction(name entry, uint64_t token_id) {
 void oswaps::reset() {
   require_auth2(get_self().value, "owner"_n.value);
   {
-    assetsa tbl(get_self(), get_self().value);
+    pools pooltable(get_self(), get_self().value);
+    std::vector<name> scopes = { get_self() };
+    for (auto p = pooltable.begin(); p != pooltable.end(); ) {
+      if (p->pool != get_self()) {
+        scopes.push_back(p->pool);
+      }
+      p = pooltable.erase(p);
+    }
+    for (const name& pool : scopes) {
+      // refund escrowed orders while their sell assets are still known
+      orders otbl(get_self(), pool.value);
+      auto oitr = otbl.begin();
+      while (oitr != otbl.end()) {
+        oitr = refund_order(otbl, oitr, "oswaps reset");
+      }
+      ordercounts ctbl(get_self(), pool.value);
+      auto citr = ctbl.begin();
+      while (citr != ctbl.end()) {
+        citr = ctbl.erase(citr);
+      }
+      assetsa tbl(get_self(), pool.value);
+      auto itr = tbl.begin();
+      while (itr != tbl.end()) {
+        itr = erase_asset(tbl, itr);
+      }
+    }
+  }
+  {
+    tokencontracts tbl(get_self(), get_self().value);
+    auto itr = tbl.begin();
+    while (itr != tbl.end()) {
+      itr = tbl.erase(itr);
+    }
+  }
+  {
+    ratelimits tbl(get_self(), get_self().value);
+    auto itr = tbl.begin();
+    while (itr != tbl.end()) {
+      itr = tbl.erase(itr);
+    }
+  }
+  {
+    wdqueue tbl(get_self(), get_self().value);
     auto itr = tbl.begin();
     while (itr != tbl.end()) {
       itr = tbl.erase(itr);
     }
-    // TODO destroy LIQ tokens
   }
   configs configset(get_self(), get_self().value);
   if(configset.exists()) { configset.remove(); }
@@ -91,6 +144,7 @@ void oswaps::resetacct( const name& account )
     accounts tbl(get_self(),account.value);
     auto itr = tbl.begin();
     while (itr != tbl.end()) {
+      sync_holder(account, asset(0, itr->balance.symbol), same_payer); // drops the holder row
       itr = tbl.erase(itr);
     }
 }
@@ -114,13 +168,146 @@ void oswaps::init(name manager, string chain) {
   configset.set(cfg, get_self());
 }
 
-void oswaps::freeze(name actor, uint64_t token_id, string symbol) {
+oswaps::pooltype oswaps::get_pool(name pool) {
+  pools pooltable(get_self(), get_self().value);
+  auto p = pooltable.find(pool.value);
+  if (p != pooltable.end() && pool != get_self()) {
+    return *p;
+  }
+  check(pool == get_self(), "unrecog pool");
+  // the default pool is always managed by the config manager; its row,
+  //   if any, only records the frozen flag
   configs configset(get_self(), get_self().value);
   check(configset.exists(), "not configured.");
-  auto cfg = configset.get();
-  check(actor == cfg.manager, "must be manager");
+  bool frozen = p != pooltable.end() && p->frozen;
+  return pooltype{ get_self(), configset.get().manager, frozen };
+}
+
+void oswaps::require_pool_manager(name actor, name pool) {
+  check(actor == get_pool(pool).manager, "must be pool manager");
   require_auth(actor);
+}
+
+void oswaps::createpool(name pool, name manager) {
+  configs configset(get_self(), get_self().value);
+  check(configset.exists(), "not configured.");
+  require_auth(configset.get().manager);
+  check(pool != get_self(), "default pool cannot be created");
+  check(is_account(manager), "manager account does not exist");
+  pools pooltable(get_self(), get_self().value);
+  check(pooltable.find(pool.value) == pooltable.end(), "pool already exists");
+  pooltable.emplace(get_self(), [&]( auto& s ) {
+    s.pool = pool;
+    s.manager = manager;
+    s.frozen = false;
+  });
+}
+
+void oswaps::freezepool(name actor, name pool, bool freeze) {
+  auto p = get_pool(pool);
+  check(actor == p.manager, "must be pool manager");
+  require_auth(actor);
+  pools pooltable(get_self(), get_self().value);
+  auto existing = pooltable.find(pool.value);
+  if (existing == pooltable.end()) { // default pool has no row until frozen
+    pooltable.emplace(get_self(), [&]( auto& s ) {
+      s.pool = pool;
+      s.manager = name(); // resolved from config by get_pool
+      s.frozen = freeze;
+    });
+  } else {
+    pooltable.modify(existing, same_payer, [&]( auto& s ) {
+      s.frozen = freeze;
+    });
+  }
+}
+
+uint64_t oswaps::backfill(uint64_t cursor, uint32_t limit) {
+  require_auth(get_self());
   assetsa assettable(get_self(), get_self().value);
+  auto by_cs = assettable.get_index<"bycontrsym"_n>();
+  uint32_t counter = 0;
+  tokencontracts tctable(get_self(), get_self().value);
+  auto a = assettable.lower_bound(cursor);
+  while (a != assettable.end()) {
+    if (++counter > limit) {
+      return a->token_id;
+    }
+    bool indexed = by_cs.find(a->by_contract_sym()) != by_cs.end();
+    if (indexed && a->balance.has_value()) {
+      ++a; // written by createasseta, so nothing is missing
+      continue;
+    }
+    if (!indexed) {
+      auto tc = tctable.find(a->contract_name.value);
+      if (tc == tctable.end()) {
+        tctable.emplace(get_self(), [&]( auto& s ) {
+          s.contract = a->contract_name;
+          s.asset_count = 1;
+        });
+      } else {
+        tctable.modify(tc, same_payer, [&]( auto& s ) {
+          s.asset_count += 1;
+        });
+      }
+    }
+    assettypea row = *a;
+    if (!row.balance.has_value()) {
+      // before pools, the default pool held all of oswaps' tokens
+      stats stattable(row.contract_name, row.symbol.raw());
+      auto st = stattable.require_find(row.symbol.raw(), "can't stat symbol");
+      asset balance(0, st->supply.symbol);
+      accounts accttable(row.contract_name, get_self().value);
+      auto ac = accttable.find(row.symbol.raw());
+      if (ac != accttable.end()) {
+        balance.amount = ac->balance.amount;
+      }
+      row.balance = balance;
+    }
+    // re-emplacing the row writes every secondary index entry
+    //   and the balance extension
+    a = assettable.erase(a);
+    assettable.emplace(get_self(), [&]( auto& s ) {
+      s = row;
+    });
+  }
+  return 0;
+}
+
+void oswaps::resetpool(name pool, uint32_t limit) {
+  require_auth2(get_self().value, "owner"_n.value);
+  uint32_t counter = 0;
+  // refund escrowed orders while their sell assets are still known
+  orders otbl(get_self(), pool.value);
+  auto oitr = otbl.begin();
+  while (oitr != otbl.end()) {
+    if (++counter > limit) { return; }
+    oitr = refund_order(otbl, oitr, "oswaps pool reset");
+  }
+  ordercounts ctbl(get_self(), pool.value);
+  auto citr = ctbl.begin();
+  while (citr != ctbl.end()) {
+    if (++counter > limit) { return; }
+    citr = ctbl.erase(citr);
+  }
+  assetsa tbl(get_self(), pool.value);
+  auto itr = tbl.begin();
+  while (itr != tbl.end()) {
+    if (++counter > limit) { return; }
+    itr = erase_asset(tbl, itr);
+  }
+  pools pooltable(get_self(), get_self().value);
+  auto p = pooltable.find(pool.value);
+  if (p != pooltable.end()) {
+    pooltable.erase(p);
+  }
+}
+
+void oswaps::freeze(name actor, uint64_t token_id, string symbol,
+                    const binary_extension<name>& pool) {
+  name scope = pool_scope(pool);
+  require_pool_manager(actor, scope);
+  assetsa assettable(get_self(), scope.value);
   auto a = assettable.require_find(token_id, "unrecog token id");
   check(a->symbol == symbol_code(symbol), "mismatched symbol");
   assettable.modify( a, same_payer, [&]( auto& s ) {
@@ -128,13 +315,11 @@ void oswaps::freeze(name actor, uint64_t token_id, string symbol) {
   });
 }
 
-void oswaps::unfreeze(name actor, uint64_t token_id, string symbol) {
-  configs configset(get_self(), get_self().value);
-  check(configset.exists(), "not configured.");
-  auto cfg = configset.get();
-  check(actor == cfg.manager, "must be manager");
-  require_auth(actor);
-  assetsa assettable(get_self(), get_self().value);
+void oswaps::unfreeze(name actor, uint64_t token_id, string symbol,
+                      const binary_extension<name>& pool) {
+  name scope = pool_scope(pool);
+  require_pool_manager(actor, scope);
+  assetsa assettable(get_self(), scope.value);
   auto a = assettable.require_find(token_id, "unrecog token id");
   check(a->symbol == symbol_code(symbol), "mismatched symbol");
   assettable.modify( a, same_payer, [&]( auto& s ) {
@@ -142,37 +327,66 @@ void oswaps::unfreeze(name actor, uint64_t token_id, string symbol) {
   });
 }
 
-oswaps::poolStatus oswaps::querypool(std::vector<uint64_t> token_id_list){
+oswaps::poolStatus oswaps::querypool(std::vector<uint64_t> token_id_list,
+                                     const binary_extension<name>& pool){
   poolStatus rv;
-  assetsa assettable(get_self(), get_self().value);
+  assetsa assettable(get_self(), pool_scope(pool).value);
+  if (token_id_list.empty()) {
+    for (auto a = assettable.begin(); a != assettable.end(); ++a) {
+      rv.status_entries.push_back(statusEntry{ a->token_id, a->balance.value(), a->weight });
+    }
+    return rv;
+  }
   for (const uint64_t& token_id : token_id_list) {
     auto a = assettable.require_find(token_id, "unrecog token id in query list");
-    name contract = a->contract_name;
-    accounts accttable(contract, get_self().value);
-    auto ac = accttable.find(a->symbol.raw());
-    stats stattable(contract, a->symbol.raw());
-    auto st = stattable.require_find(a->symbol.raw(), "can't stat symbol");
-    asset balance(0, st->supply.symbol);
-    if(ac != accttable.end()) {
-      balance.amount = ac->balance.amount;
-    }
     statusEntry e;
     e.token_id = token_id;
-    e.balance = balance;
+    e.balance = a->balance.value();
     e.weight = a->weight;
     rv.status_entries.push_back(e);
   }
   return rv;
 }
 
-void oswaps::createasseta(name actor, string chain, name contract, symbol_code symbol, string meta) {
+oswaps::holderPage oswaps::getholders(symbol_code liq_symbol, name cursor, uint32_t limit) {
+  check(limit > 0 && limit <= max_holder_page, "getholders: limit out of range");
+  holderPage rv;
+  holders hldrs(get_self(), liq_symbol.raw());
+  auto h = hldrs.lower_bound(cursor.value);
+  for (; h != hldrs.end() && rv.holders.size() < limit; ++h) {
+    rv.holders.push_back(holderEntry{ h->account, h->balance });
+  }
+  if (h != hldrs.end()) {
+    rv.next = h->account;
+  }
+  return rv;
+}
+
+uint64_t oswaps::getassetid(name contract, symbol_code symbol,
+                            const binary_extension<name>& pool) {
+  assetsa assettable(get_self(), pool_scope(pool).value);
+  auto by_cs = assettable.get_index<"bycontrsym"_n>();
+  auto a = by_cs.find(contract_sym_key(contract, symbol));
+  check(a != by_cs.end(), "unrecog token contract & symbol");
+  return a->token_id;
+}
+
+void oswaps::createasseta(name actor, string chain, name contract, symbol_code symbol, string meta,
+                          const binary_extension<name>& pool) {
   require_auth(actor);
   check(contract != get_self(), "asset contract cannot be oswaps");
-  assetsa assettable(get_self(), get_self().value);
+  name scope = pool_scope(pool);
+  get_pool(scope); // pool must exist
+  assetsa assettable(get_self(), scope.value);
   // TODO parse chain into chain_name, chain_code
   string chain_name = "Telos";
   checksum256 chain_code = telos_chain_id;
   check(chain == chain_name, "currently only Telos chain supported");
+  auto by_cs = assettable.get_index<"bycontrsym"_n>();
+  check(by_cs.find(contract_sym_key(contract, symbol)) == by_cs.end(),
+    "asset already registered");
+  stats astattable(contract, symbol.raw());
+  auto ast = astattable.require_find(symbol.raw(), "can't stat symbol");
   configs configset(get_self(), get_self().value);
   auto cfg = configset.get();
   cfg.last_token_id += 1;
@@ -185,10 +399,21 @@ void oswaps::createasseta(name actor, string chain, name contract, symbol_code s
     s.active = false;
     s.metadata = meta;
     s.weight = 0.0;
+    s.balance = asset(0, ast->supply.symbol);
   });
+  tokencontracts tctable(get_self(), get_self().value);
+  auto tc = tctable.find(contract.value);
+  if (tc == tctable.end()) {
+    tctable.emplace(actor, [&]( auto& s ) {
+      s.contract = contract;
+      s.asset_count = 1;
+    });
+  } else {
+    tctable.modify(tc, same_payer, [&]( auto& s ) {
+      s.asset_count += 1;
+    });
+  }
   // create LIQ token with correct precision
-  stats astattable(contract, symbol.raw());
-  auto ast = astattable.require_find(symbol.raw(), "can't stat symbol");
   auto liq_sym_code = symbol_code(sym_from_id(cfg.last_token_id, "LIQ"));
   auto liq_sym = eosio::symbol(liq_sym_code, ast->supply.symbol.precision());
   printf("liq sym code id %llu %s %s", cfg.last_token_id,
@@ -212,15 +437,45 @@ void oswaps::createasseta(name actor, string chain, name contract, symbol_code s
   } 
 }
 
-void oswaps::forgetasset(name actor, uint64_t token_id, string memo) {
-  configs configset(get_self(), get_self().value);
-  check(configset.exists(), "not configured.");
-  auto cfg = configset.get();
-  check(actor == cfg.manager, "must be manager");
-  require_auth(actor);
-  assetsa assettable(get_self(), get_self().value);
+void oswaps::forgetasset(name actor, uint64_t token_id, string memo,
+                         const binary_extension<name>& pool) {
+  name scope = pool_scope(pool);
+  require_pool_manager(actor, scope);
+  assetsa assettable(get_self(), scope.value);
   auto a = assettable.require_find(token_id, "unrecog token id");
-  assettable.erase(a);
+  // orders selling this asset could no longer be cancelled; refund them first
+  orders ordertable(get_self(), scope.value);
+  auto by_pp = ordertable.get_index<"bypairprice"_n>();
+  uint128_t sell_end = order_key(token_id + 1, 0, 0);
+  uint32_t counter = 0;
+  for (auto o = by_pp.lower_bound(order_key(token_id, 0, 0));
+       o != by_pp.end() && o->by_pair_price() < sell_end;
+       o = by_pp.lower_bound(order_key(token_id, 0, 0))) {
+    if (++counter > max_process_limit) { return; } // repeat to finish
+    refund_order(ordertable, ordertable.find(o->id), "oswaps asset removed");
+  }
+  erase_asset(assettable, a);
+}  
+
+oswaps::assetsa::const_iterator oswaps::erase_asset(assetsa& assettable, assetsa::const_iterator a) {
+  uint64_t token_id = a->token_id;
+  tokencontracts tctable(get_self(), get_self().value);
+  auto tc = tctable.find(a->contract_name.value);
+  if (tc != tctable.end()) {
+    if (tc->asset_count <= 1) {
+      tctable.erase(tc);
+    } else {
+      tctable.modify(tc, same_payer, [&]( auto& s ) {
+        s.asset_count -= 1;
+      });
+    }
+  }
+  ratelimits rltable(get_self(), get_self().value);
+  auto rl = rltable.find(token_id);
+  if (rl != rltable.end()) {
+    rltable.erase(rl);
+  }
+  auto next = assettable.erase(a);
   // should we check for zero balance before destroying LIQ token?
   auto liq_sym_code = symbol_code(sym_from_id(token_id, "LIQ"));
   stats lstattable(get_self(), liq_sym_code.raw());
@@ -228,77 +483,372 @@ void oswaps::forgetasset(name actor, uint64_t token_id, string memo) {
   while ( lst != lstattable.end()) {
     lst = lstattable.erase(lst);
   }
+  holders hldrs(get_self(), liq_sym_code.raw());
+  auto h = hldrs.begin();
+  while (h != hldrs.end()) {
+    h = hldrs.erase(h);
+  }
   // accounts table has stranded ram & data which could create weirdness
-}  
+  return next;
+}
 
-void oswaps::withdraw(name account, uint64_t token_id, string amount, float weight) {
-  configs configset(get_self(), get_self().value);
-  check(configset.exists(), "not configured.");
-  auto cfg = configset.get();
-  require_auth(cfg.manager);
-  assetsa assettable(get_self(), get_self().value);
+void oswaps::withdraw(name account, uint64_t token_id, string amount, float weight,
+                      const binary_extension<name>& pool) {
+  name scope = pool_scope(pool);
+  auto p = get_pool(scope);
+  require_auth(p.manager);
+  assetsa assettable(get_self(), scope.value);
+  withdraw_one(assettable, p, account, token_id, amount, weight);
+}
+
+void oswaps::withdrawmany(name account, std::vector<liqLeg> legs,
+                          const binary_extension<name>& pool) {
+  check(legs.size() > 0 && legs.size() <= max_batch_legs, "withdrawmany: leg count out of range");
+  name scope = pool_scope(pool);
+  auto p = get_pool(scope);
+  require_auth(p.manager);
+  assetsa assettable(get_self(), scope.value);
+  for (const liqLeg& leg : legs) {
+    withdraw_one(assettable, p, account, leg.token_id, leg.amount, leg.weight);
+  }
+}
+
+void oswaps::withdraw_one(assetsa& assettable, const pooltype& p, name account,
+                          uint64_t token_id, const string& amount, float weight) {
   auto a = assettable.require_find(token_id, "unrecog token id");
   // TODO verify chain, family, and contract
-  stats stattable(a->contract_name, a->symbol.raw());
-  auto st = stattable.require_find(a->symbol.raw(), "can't stat symbol");
-  uint64_t amount64 = amount_from(st->supply.symbol, amount);
-  asset qty = asset(amount64, st->supply.symbol);
-  accounts accttable(a->contract_name, get_self().value);
-  auto ac = accttable.find(a->symbol.raw());
-  uint64_t bal_before = 0;
-  if(ac != accttable.end()) {
-    bal_before = ac->balance.amount;
-  }
-  check(bal_before > amount64, "withdraw: insufficient balance");
+  uint64_t amount64 = amount_from(a->balance.value().symbol, amount);
+  asset qty = asset(amount64, a->balance.value().symbol);
+  ratelimits rltable(get_self(), get_self().value);
+  if (rltable.find(token_id) == rltable.end()) {
+    check(release_withdrawal(assettable, *a, account, qty, weight),
+      "withdraw: insufficient balance");
+    return;
+  }
+  // rate limited: queue for release by `process`
+  check(a->balance.value().amount > amount64, "withdraw: insufficient balance");
+  wdqueue queue(get_self(), get_self().value);
+  queue.emplace(p.manager, [&](auto& s) {
+    s.id = queue.available_primary_key();
+    s.account = account;
+    s.pool = p.pool;
+    s.token_id = token_id;
+    s.quantity = qty;
+    s.weight = weight;
+    s.queued_at = current_time_point();
+  });
+}
+
+bool oswaps::release_withdrawal(assetsa& assettable, const assettypea& a,
+                                name account, const asset& qty, float weight) {
+  uint64_t bal_before = a.balance.value().amount;
+  if(bal_before <= qty.amount) {
+    return false;
+  }
+  auto liq_sym_code = symbol_code(sym_from_id(a.token_id, "LIQ"));
+  asset lqty = qty;
+  lqty.symbol = symbol(liq_sym_code, qty.symbol.precision());
+  accounts liqaccts(get_self(), account.value);
+  auto lac = liqaccts.find(liq_sym_code.raw());
+  if(lac == liqaccts.end() || lac->balance.amount < lqty.amount) {
+    return false;
+  }
   float new_weight = weight;
   if(weight == 0.0) {
-    new_weight = a->weight * (1.0 - float(amount64)/bal_before);
+    new_weight = a.weight * (1.0 - float(qty.amount)/bal_before);
   }
   assettable.modify(a, same_payer, [&](auto& s) {
     s.weight = new_weight;
     s.active &= (weight == 0.0);
+    s.balance.value() -= qty;
   });
-  // burn LIQ tokens 
-  cfg.withdraw_flag = true;
-  configset.set(cfg, get_self());
-  // send the LIQ tokens home to retire
-  auto liq_sym_code = symbol_code(sym_from_id(token_id, "LIQ"));
-  stats lstatstable( get_self(), liq_sym_code.raw() );
-  const auto& lst = lstatstable.get( liq_sym_code.raw() );
-  asset lqty = qty;
-  lqty.symbol = symbol(liq_sym_code, qty.symbol.precision());
+  opReceipt r{ "withdraw"_n, name(assettable.get_scope()), account, account, a.token_id, a.token_id,
+               lqty, qty, asset(bal_before, qty.symbol), a.balance.value(),
+               asset(bal_before, qty.symbol), a.balance.value(), a.weight, a.weight };
+  // send the LIQ tokens home and burn them
   action (
     permission_level{get_self(), "active"_n},
     get_self(),
     "transfer"_n,
     std::make_tuple(account, get_self(), lqty, std::string("oswaps withdrawal"))
   ).send();
+  action (
+    permission_level{get_self(), "active"_n},
+    get_self(),
+    "retire"_n,
+    std::make_tuple(lqty, std::string("oswaps withdrawal"))
+  ).send();
   // send out the withdrawn tokens 
   action (
     permission_level{get_self(), "active"_n},
-    a->contract_name,
+    a.contract_name,
     "transfer"_n,
     std::make_tuple(get_self(), account, qty, std::string("oswaps withdrawal"))
   ).send(); 
+  send_receipt(r);
+  return true;
+}
+
+void oswaps::setratelimit(name actor, uint64_t token_id, string max_amount, uint32_t window_sec,
+                          const binary_extension<name>& pool) {
+  name scope = pool_scope(pool);
+  require_pool_manager(actor, scope);
+  assetsa assettable(get_self(), scope.value);
+  auto a = assettable.require_find(token_id, "unrecog token id");
+  int64_t max64 = amount_from(a->balance.value().symbol, max_amount);
+  ratelimits rltable(get_self(), get_self().value);
+  auto rl = rltable.find(token_id);
+  if (max64 == 0) {
+    if (rl != rltable.end()) {
+      rltable.erase(rl);
+    }
+    return;
+  }
+  check(window_sec > 0, "window must be positive");
+  if (rl == rltable.end()) {
+    rltable.emplace(actor, [&](auto& s) {
+      s.token_id = token_id;
+      s.max_amount = max64;
+      s.window_sec = window_sec;
+      s.window_start = current_time_point();
+      s.window_used = 0;
+    });
+  } else {
+    rltable.modify(rl, same_payer, [&](auto& s) {
+      s.max_amount = max64;
+      s.window_sec = window_sec;
+    });
+  }
+}
+
+void oswaps::process(uint32_t limit) {
+  check(limit > 0 && limit <= max_process_limit, "process: limit out of range");
+  wdqueue queue(get_self(), get_self().value);
+  ratelimits rltable(get_self(), get_self().value);
+  time_point_sec now = current_time_point();
+  // walk the queue token by token, oldest request first within each token
+  auto by_token = queue.get_index<"bytoken"_n>();
+  uint32_t handled = 0;
+  auto itr = by_token.begin();
+  while (itr != by_token.end() && handled < limit) {
+    uint64_t token_id = itr->token_id;
+    auto rl = rltable.find(token_id);
+    bool new_window = false;
+    int64_t used = 0;
+    if (rl != rltable.end()) {
+      new_window = now >= rl->window_start + rl->window_sec;
+      used = new_window ? 0 : rl->window_used;
+      if (used > 0 && used + itr->quantity.amount > rl->max_amount) {
+        // window used up: skip the rest of this token's queue in one lookup
+        itr = by_token.lower_bound((uint128_t)(token_id + 1) << 64);
+        continue;
+      }
+    }
+    ++handled;
+    assetsa assettable(get_self(), itr->pool.value);
+    auto a = assettable.find(token_id);
+    if (a == assettable.end()
+        || !release_withdrawal(assettable, *a, itr->account, itr->quantity, itr->weight)) {
+      // nothing moved: both balances are reported unchanged
+      asset bal = a == assettable.end() ? asset(0, itr->quantity.symbol) : a->balance.value();
+      float w = a == assettable.end() ? 0.0 : a->weight;
+      send_receipt(opReceipt{ "wddropped"_n, itr->pool, itr->account, itr->account, token_id, token_id,
+                              asset(0, itr->quantity.symbol), itr->quantity, bal, bal, bal, bal, w, w });
+    } else if (rl != rltable.end()) {
+      rltable.modify(rl, same_payer, [&](auto& s) {
+        if (new_window) {
+          s.window_start = now;
+        }
+        s.window_used = used + itr->quantity.amount;
+      });
+    }
+    itr = by_token.erase(itr);
+  }
 }
 
 void oswaps::addliqprep(name account, uint64_t token_id,
-                            string amount, float weight) {
+                            string amount, float weight, const binary_extension<name>& pool) {
                           
-  save_transaction("addliqprep"_n, token_id);
+  save_transaction("addliqprep"_n, token_id, pool_scope(pool));
 
 }
 
+void oswaps::addliqmulti(name account, std::vector<liqLeg> legs,
+                         const binary_extension<name>& pool) {
+  check(legs.size() > 0 && legs.size() <= max_batch_legs, "addliqmulti: leg count out of range");
+  std::vector<uint64_t> token_ids;
+  for (const liqLeg& leg : legs) {
+    check(std::find(token_ids.begin(), token_ids.end(), leg.token_id) == token_ids.end(),
+      "addliqmulti: duplicate token id");
+    token_ids.push_back(leg.token_id);
+  }
+  save_transaction("addliqmulti"_n, token_ids, pool_scope(pool));
+}
+
+void oswaps::addliq_batch(const addliqmulti_params& mp) {
+  // all transfers have arrived; one pass updates every leg's weight and balance
+  name pool = pool_scope(mp.pool);
+  check(!get_pool(pool).frozen, "pool is frozen");
+  assetsa assettable(get_self(), pool.value);
+  for (const liqLeg& leg : mp.legs) {
+    auto a = assettable.require_find(leg.token_id, "unrecog token id");
+    int64_t amount64 = amount_from(a->balance.value().symbol, leg.amount);
+    check(a->active || amount64 == 0, "token is frozen");
+    asset quantity = asset(amount64, a->balance.value().symbol);
+    uint64_t bal_before = a->balance.value().amount;
+    float new_weight = leg.weight;
+    if(new_weight == 0.0) {
+      check(bal_before > 0, "zero weight requires existing balance");
+      new_weight = a->weight * (1.0 + float(amount64)/bal_before);
+    }
+    assettable.modify(a, same_payer, [&](auto& s) {
+      s.weight = new_weight;
+      s.active &= (leg.weight == 0.0);
+      s.balance.value() += quantity;
+    });
+    // credit LIQ tokens directly, without an inline transfer per leg
+    auto liq_sym_code = symbol_code(sym_from_id(leg.token_id, "LIQ"));
+    asset lqty = quantity;
+    lqty.symbol = symbol(liq_sym_code, quantity.symbol.precision());
+    if (amount64 > 0) {
+      stats lstatstable( get_self(), liq_sym_code.raw() );
+      const auto& lst = lstatstable.get( liq_sym_code.raw() );
+      lstatstable.modify( lst, same_payer, [&]( auto& s ) {
+        s.supply += lqty;
+      });
+      add_balance( mp.account, lqty, get_self() );
+    }
+    send_receipt(opReceipt{ "addliq"_n, pool, mp.account, mp.account, a->token_id, a->token_id,
+                            quantity, lqty, asset(bal_before, quantity.symbol), a->balance.value(),
+                            asset(bal_before, quantity.symbol), a->balance.value(), a->weight, a->weight });
+  }
+}
+
 void oswaps::exprepfrom(
            name sender, name recipient, uint64_t in_token_id, uint64_t out_token_id,
-           string in_amount, string memo) {
-  save_transaction("exprepfrom"_n, in_token_id);
+           string in_amount, string memo, const binary_extension<name>& pool) {
+  save_transaction("exprepfrom"_n, in_token_id, pool_scope(pool));
 }
 
 void oswaps::exprepto(
            name sender, name recipient, uint64_t in_token_id, uint64_t out_token_id,
-           string out_amount, string memo) {
-  save_transaction("exprepto"_n, in_token_id);
+           string out_amount, string memo, const binary_extension<name>& pool) {
+  save_transaction("exprepto"_n, in_token_id, pool_scope(pool));
+}
+
+void oswaps::receipt(const opReceipt& r) {
+  require_auth(get_self());
+}
+
+void oswaps::send_receipt(const opReceipt& r) {
+  action (
+    permission_level{get_self(), "active"_n},
+    get_self(),
+    "receipt"_n,
+    std::make_tuple(r)
+  ).send();
+}
+
+void oswaps::orderprep(name maker, uint64_t sell_token_id, uint64_t buy_token_id,
+                       string sell_amount, string buy_amount, const binary_extension<name>& pool) {
+  require_auth(maker);
+  save_transaction("orderprep"_n, sell_token_id, pool_scope(pool));
+}
+
+void oswaps::cancelorder(name maker, uint64_t order_id, const binary_extension<name>& pool) {
+  require_auth(maker);
+  orders ordertable(get_self(), pool_scope(pool).value);
+  auto o = ordertable.require_find(order_id, "unrecog order id");
+  check(o->maker == maker, "not the order maker");
+  refund_order(ordertable, o, "oswaps order cancelled");
+}
+
+oswaps::orders::const_iterator oswaps::refund_order(orders& ordertable, orders::const_iterator o,
+                                                    const string& memo) {
+  name pool = name(ordertable.get_scope());
+  assetsa assettable(get_self(), pool.value);
+  auto a = assettable.require_find(o->sell_token_id, "unrecog token id");
+  action (
+    permission_level{get_self(), "active"_n},
+    a->contract_name,
+    "transfer"_n,
+    std::make_tuple(get_self(), o->maker, o->remaining, memo)
+  ).send();
+  count_order(pool, o->maker, -1);
+  return ordertable.erase(o);
+}
+
+void oswaps::count_order(name pool, name maker, int32_t delta) {
+  ordercounts cnttable(get_self(), pool.value);
+  auto c = cnttable.find(maker.value);
+  if (c == cnttable.end()) {
+    if (delta > 0) {
+      cnttable.emplace(get_self(), [&](auto& s) {
+        s.maker = maker;
+        s.count = delta;
+      });
+    }
+    return; // orders placed before counting began
+  }
+  if ((int64_t)c->count + delta <= 0) {
+    cnttable.erase(c);
+  } else {
+    cnttable.modify(c, same_payer, [&](auto& s) {
+      s.count += delta;
+    });
+  }
+}
+
+int64_t oswaps::fill_orders(orders& ordertable, const assettypea& ain, const assettypea& aout,
+                            double spot_price, bool input_is_exact, int64_t& remaining) {
+  // resting orders which sell the swap output for the swap input, cheapest first
+  auto by_pp = ordertable.get_index<"bypairprice"_n>();
+  uint128_t pair_end = order_key(aout.token_id, ain.token_id, 0) + ((uint128_t)1 << 64);
+  auto o = by_pp.lower_bound(order_key(aout.token_id, ain.token_id, 0));
+  int64_t counter_amount = 0; // output delivered, or input consumed
+  uint32_t fills = 0;
+  while (remaining > 0 && o != by_pp.end() && o->by_pair_price() < pair_end
+         && fills < max_order_fills && o->price <= spot_price) {
+    int64_t take = o->remaining.amount; // in output token units
+    if (input_is_exact) {
+      int64_t affordable = (uint128_t)remaining * price_scale / o->price;
+      take = std::min(take, affordable);
+    } else {
+      take = std::min(take, remaining);
+    }
+    if (take == 0) {
+      break;
+    }
+    // maker is paid rounded up, so a partial fill never underprices the order
+    int64_t cost = ((uint128_t)take * o->price + price_scale - 1) / price_scale;
+    if (input_is_exact) {
+      remaining -= cost;
+      counter_amount += take;
+    } else {
+      remaining -= take;
+      counter_amount += cost;
+    }
+    if (cost > 0) {
+      action (
+        permission_level{get_self(), "active"_n},
+        ain.contract_name,
+        "transfer"_n,
+        std::make_tuple(get_self(), o->maker, asset(cost, ain.balance.value().symbol),
+          std::string("oswaps limit order fill"))
+      ).send();
+    }
+    ++fills;
+    if (take == o->remaining.amount) {
+      count_order(name(ordertable.get_scope()), o->maker, -1);
+      o = by_pp.erase(o);
+    } else {
+      by_pp.modify(o, same_payer, [&](auto& s) {
+        s.remaining.amount -= take;
+      });
+      break; // a partially filled order exhausts the swap
+    }
+  }
+  return counter_amount;
 }
 
 void oswaps::transfer( const name& from, const name& to, const asset& quantity,
@@ -328,24 +878,25 @@ void oswaps::transfer( const name& from, const name& to, const asset& quantity,
 
     sub_balance( from, quantity );
     add_balance( to, quantity, payer );
-    
-    // check whether this transfer is inline action from 'withdraw'
-    configs configset(get_self(), get_self().value);
-    if(!configset.exists()) { return; }
-    auto cfg = configset.get();
-    if (!cfg.withdraw_flag) { return; }
-    cfg.withdraw_flag = false;
-    configset.set(cfg, get_self());    
-    action (
-      permission_level{get_self(), "active"_n},
-      get_self(),
-      "retire"_n,
-      std::make_tuple(quantity, std::string("oswaps withdrawal"))
-    ).send();
 }
 
    
 void oswaps::ontransfer(name from, name to, eosio::asset quantity, string memo) {
+    // outgoing payouts need no processing; a prep action is always
+    // followed by a transfer *to* oswaps (see save_transaction)
+    if (to != get_self()) {
+      return;
+    }
+    // tokens from contracts with no registered asset cannot match a prep
+    name tkcontract = get_first_receiver();
+    tokencontracts tctable(get_self(), get_self().value);
+    if (tctable.find(tkcontract.value) == tctable.end()) {
+      // refuse rather than absorb a deposit that a pending prep expects
+      check(!txx(get_self(), get_self().value).exists(),
+            "token contract " + tkcontract.to_string() + " has no registered asset");
+      return;
+    }
+
     // check if there is a stored transaction
     // if not, this is an unrestricted transfer into oswaps
     // [should we also require a confirming memo field?]
@@ -354,14 +905,7 @@ void oswaps::ontransfer(name from, name to, eosio::asset quantity, string memo)
       return;
     }
 
-    if (from == get_self()) {
-      txset.remove();
-      return;
-    }
-
-    check(to == get_self(), "This transfer is not for oswaps"); // dispatch error?
     check(quantity.amount >= 0, "transfer quantity must be positive");
-    name tkcontract = get_first_receiver();
 
     // analyze the stored transaction
     auto tx = txset.get();
@@ -369,46 +913,51 @@ void oswaps::ontransfer(name from, name to, eosio::asset quantity, string memo)
     //printf("retrieved serialized tx, size %d ", size);
     transaction trx = unpack<transaction>(tx.txdata.data(), size);
     int action_count = trx.actions.size();
-    auto prep_action = trx.actions[action_count-2];
     check (action_count >= 2, "malformed oswaps trx, <2 actions");
-    prep_action = trx.actions[action_count-2]; // should be the prep action
+    int prep_index = action_count-2; // should be the prep action
+    if (tx.legs_done.has_value()) {
+      // multi-leg prep is followed by one transfer per leg
+      while (prep_index > 0 && trx.actions[prep_index].account != get_self()) {
+        --prep_index;
+      }
+    }
+    auto prep_action = trx.actions[prep_index];
     check(prep_action.account == get_self(), "malformed oswaps tx, prep should be next to final");
     name prep_type = prep_action.name;
-    assetsa assettable(get_self(), get_self().value);
     
     if (prep_type == "addliqprep"_n) {
       addliqprep_params ap = unpack<addliqprep_params>(prep_action.data.data(), prep_action.data.size());
+      name pool = pool_scope(ap.pool);
+      check(!get_pool(pool).frozen, "pool is frozen");
+      assetsa assettable(get_self(), pool.value);
+      auto by_cs = assettable.get_index<"bycontrsym"_n>();
 
-      auto a = assettable.require_find(ap.token_id, "unrecog token id");
+      auto a = by_cs.find(contract_sym_key(tkcontract, quantity.symbol.code()));
+      check(a != by_cs.end(), "unrecog transfer token contract & symbol");
       // TODO verify chain & family
-      check(a->contract_name == tkcontract, "transfer token contract mismatched to prep");
-      check(a->symbol == quantity.symbol.code(), "transfer symbol mismatched to prep");
-      stats stattable(a->contract_name, a->symbol.raw());
-      auto st = stattable.require_find(a->symbol.raw(), "can't stat symbol");
-      check(st->supply.symbol==quantity.symbol, "transfer symbol/prec mismatched to prep");
-      uint64_t amount64 = amount_from(st->supply.symbol, ap.amount);
+      check(a->token_id == ap.token_id, "transfer token mismatched to prep");
+      check(a->balance.value().symbol==quantity.symbol, "transfer symbol/prec mismatched to prep");
+      uint64_t amount64 = amount_from(a->balance.value().symbol, ap.amount);
       check(amount64 == quantity.amount, "transfer qty mismatched to prep");   
       check(a->active || amount64 == 0, "token is frozen");   
-      accounts accttable(a->contract_name, get_self().value);
-      auto ac = accttable.require_find(a->symbol.raw(), "no pool balance after transfer in");
-      // must back out transfer which just occurred
-      uint64_t bal_before = ac->balance.amount - quantity.amount;
+      uint64_t bal_before = a->balance.value().amount;
       float new_weight = ap.weight;
       if(new_weight == 0.0) {
         check(bal_before > 0, "zero weight requires existing balance");
         new_weight = a->weight * (1.0 + float(amount64)/bal_before);
       }
-      assettable.modify(a, same_payer, [&](auto& s) {
+      assettable.modify(*a, same_payer, [&](auto& s) {
         s.weight = new_weight;
         s.active &= (ap.weight == 0.0);
+        s.balance.value() += quantity;
       });
+      auto liq_sym_code = symbol_code(sym_from_id(ap.token_id, "LIQ"));
+      asset lqty = quantity;
+      lqty.symbol = symbol(liq_sym_code, quantity.symbol.precision());
       if (quantity.amount > 0) {
         // issue LIQ tokens to self & transfer to `from` account
-        auto liq_sym_code = symbol_code(sym_from_id(ap.token_id, "LIQ"));
         stats lstatstable( get_self(), liq_sym_code.raw() );
         const auto& lst = lstatstable.get( liq_sym_code.raw() );
-        asset lqty = quantity;
-        lqty.symbol = symbol(liq_sym_code, quantity.symbol.precision());
         add_balance( get_self(), lqty, get_self() );
         lstatstable.modify( lst, same_payer, [&]( auto& s ) {
           s.supply += lqty;
@@ -421,7 +970,66 @@ void oswaps::ontransfer(name from, name to, eosio::asset quantity, string memo)
              std::string("oswaps liquidity receipt "))
         ).send();
       }
+      send_receipt(opReceipt{ "addliq"_n, pool, from, from, a->token_id, a->token_id,
+                              quantity, lqty, asset(bal_before, quantity.symbol), a->balance.value(),
+                              asset(bal_before, quantity.symbol), a->balance.value(), a->weight, a->weight });
       
+    } else if (prep_type == "addliqmulti"_n) {
+      addliqmulti_params mp = unpack<addliqmulti_params>(prep_action.data.data(), prep_action.data.size());
+      assetsa assettable(get_self(), pool_scope(mp.pool).value);
+      uint32_t leg = tx.legs_done.value_or();
+      check(leg < mp.legs.size(), "malformed oswaps trx: unexpected transfer");
+      auto a = assettable.require_find(mp.legs[leg].token_id, "unrecog token id");
+      check(a->contract_name == tkcontract && a->balance.value().symbol == quantity.symbol,
+        "transfer token mismatched to prep");
+      check(amount_from(a->balance.value().symbol, mp.legs[leg].amount) == quantity.amount,
+        "transfer qty mismatched to prep");
+      check(from == mp.account, "transfer sender mismatched to prep");
+      if (leg + 1 < mp.legs.size()) { // wait for the remaining transfers
+        tx.legs_done = leg + 1;
+        txset.set(tx, get_self());
+        return;
+      }
+      addliq_batch(mp);
+
+    } else if (prep_type == "orderprep"_n) {
+      orderprep_params op = unpack<orderprep_params>(prep_action.data.data(), prep_action.data.size());
+      name pool = pool_scope(op.pool);
+      check(!get_pool(pool).frozen, "pool is frozen");
+      assetsa assettable(get_self(), pool.value);
+      auto by_cs = assettable.get_index<"bycontrsym"_n>();
+      auto asell = by_cs.find(contract_sym_key(tkcontract, quantity.symbol.code()));
+      check(asell != by_cs.end(), "unrecog transfer token contract & symbol");
+      check(asell->token_id == op.sell_token_id, "transfer token mismatched to prep");
+      check(asell->balance.value().symbol == quantity.symbol, "transfer symbol/prec mismatched to prep");
+      auto abuy = assettable.require_find(op.buy_token_id, "unrecog buy token id");
+      check(abuy->token_id != asell->token_id, "order tokens must differ");
+      check(asell->token_id < (1ULL << 32) && abuy->token_id < (1ULL << 32), "token id too large for order index");
+      int64_t sell64 = amount_from(asell->balance.value().symbol, op.sell_amount);
+      int64_t buy64 = amount_from(abuy->balance.value().symbol, op.buy_amount);
+      check(sell64 == quantity.amount, "transfer qty mismatched to prep");
+      check(from == op.maker, "order maker must send the offered tokens");
+      check(sell64 > 0 && buy64 > 0, "order amounts must be positive");
+      uint128_t price = (uint128_t)buy64 * price_scale / sell64;
+      check(price > 0 && (price >> 64) == 0, "order price out of range");
+      // orders are held in contract RAM, so dust and per-maker volume are bounded
+      check((uint128_t)sell64 * 1000000 >= (uint128_t)asell->balance.value().amount * min_order_ppm,
+            "order too small for pool");
+      ordercounts cnttable(get_self(), pool.value);
+      auto cnt = cnttable.find(op.maker.value);
+      check(cnt == cnttable.end() || cnt->count < max_maker_orders, "too many open orders");
+      count_order(pool, op.maker, 1);
+      orders ordertable(get_self(), pool.value);
+      ordertable.emplace(get_self(), [&](auto& s) {
+        s.id = ordertable.available_primary_key();
+        s.maker = op.maker;
+        s.sell_token_id = op.sell_token_id;
+        s.buy_token_id = op.buy_token_id;
+        s.remaining = quantity;
+        s.price = (uint64_t)price;
+        s.placed = current_time_point();
+      });
+
     } else if (prep_type == "exprepfrom"_n || prep_type == "exprepto"_n ) {
       // exchange transaction
       name out_contract;
@@ -431,113 +1039,120 @@ void oswaps::ontransfer(name from, name to, eosio::asset quantity, string memo)
       string exchange_memo;
       int64_t in_surplus = 0;
       bool input_is_exact = prep_type == "exprepfrom"_n;
+      name pool;
+      uint64_t in_token_id, out_token_id;
+      string prep_amount; // exact input or exact output amount
       if (input_is_exact) {
         exprepfrom_params efp = unpack<exprepfrom_params>(prep_action.data.data(), prep_action.data.size());
         recipient = efp.recipient;
         sender = efp.sender;
         exchange_memo = efp.memo;
-        auto ain = assettable.require_find(efp.in_token_id, "unrecog input token id");
-        check(ain->contract_name == tkcontract, "wrong token contract");
-        check(ain->symbol == quantity.symbol.code(), "transfer symbol mismatched to prep");
-        stats in_stattable(ain->contract_name, ain->symbol.raw());
-        auto stin = in_stattable.require_find(ain->symbol.raw(), "can't stat input symbol");
-        check(ain->active, "input token swap is frozen");
-        uint64_t in_amount64 = amount_from(stin->supply.symbol, efp.in_amount);
-        accounts in_accttable(ain->contract_name, get_self().value);
-        auto acin = in_accttable.require_find(ain->symbol.raw(), "no pool balance after transfer in");
-        // must back out transfer which just occurred
-        uint64_t in_bal_before = acin->balance.amount - quantity.amount;
-        check(in_bal_before > 0, "zero input balance, can't compute swap");                
-        auto aout = assettable.require_find(efp.out_token_id, "unrecog output token id");
-        out_contract = aout->contract_name;
-        stats out_stattable(aout->contract_name, aout->symbol.raw());
-        auto stout = out_stattable.require_find(aout->symbol.raw(), "can't stat output symbol");
-        check(aout->active, "output token swap is frozen");
-        //uint64_t out_amount64 = amount_from(stout->supply);.symbol, efp.out_amount);
-        accounts out_accttable(aout->contract_name, get_self().value);
-        auto acout = out_accttable.find(aout->symbol.raw());
-        uint64_t out_bal_before = 0;
-        if(acout != out_accttable.end()) {
-          out_bal_before = acout->balance.amount;
-        }
-
-        // do balancer computation 
-        double lc, lnc;
-        int64_t in_bal_after, out_bal_after, computed_amt;
-        in_bal_after = in_bal_before + in_amount64;
-        lc = log((double)in_bal_after/in_bal_before);
-        lnc = -(ain->weight/aout->weight * lc);
-        out_bal_after = llround(out_bal_before * exp(lnc));
-        computed_amt = out_bal_before - out_bal_after;
-
-        check(in_amount64 == quantity.amount, "transfer qty mismatched to prep");
-        out_qty = asset(computed_amt, stout->supply.symbol);
-        
-      } else { // output quantity is exact
+        pool = pool_scope(efp.pool);
+        in_token_id = efp.in_token_id;
+        out_token_id = efp.out_token_id;
+        prep_amount = efp.in_amount;
+      } else {
         exprepto_params etp = unpack<exprepto_params>(prep_action.data.data(), prep_action.data.size());
         recipient = etp.recipient;
         sender = etp.sender;
         exchange_memo = etp.memo;
-        auto ain = assettable.require_find(etp.in_token_id, "unrecog input token id");
-        check(ain->contract_name == tkcontract, "wrong token contract");
-        check(ain->symbol == quantity.symbol.code(), "transfer symbol mismatched to prep");
-        stats in_stattable(ain->contract_name, ain->symbol.raw());
-        auto stin = in_stattable.require_find(ain->symbol.raw(), "can't stat symbol");
-        check(ain->active, "input token swap is frozen");
-        //uint64_t in_amount64 = amount_from(stin->supply.symbol, etp.in_amount);
-        accounts in_accttable(ain->contract_name, get_self().value);
-        auto acin = in_accttable.require_find(ain->symbol.raw(), "no pool balance after transfer in");
-        // must back out transfer which just occurred
-        uint64_t in_bal_before = acin->balance.amount - quantity.amount;
-        check(in_bal_before > 0, "zero input balance, can't compute swap");                
-        auto aout = assettable.require_find(etp.out_token_id, "unrecog output token id");
-        out_contract = aout->contract_name;
-        stats out_stattable(aout->contract_name, aout->symbol.raw());
-        auto stout = out_stattable.require_find(aout->symbol.raw(), "can't stat symbol");
-        check(aout->active, "output token swap is frozen");
-        uint64_t out_amount64 = amount_from(stout->supply.symbol, etp.out_amount);
-        accounts out_accttable(aout->contract_name, get_self().value);
-        auto acout = out_accttable.find(aout->symbol.raw());
-        uint64_t out_bal_before = 0;
-        if(acout != out_accttable.end()) {
-          out_bal_before = acout->balance.amount;
+        pool = pool_scope(etp.pool);
+        in_token_id = etp.in_token_id;
+        out_token_id = etp.out_token_id;
+        prep_amount = etp.out_amount;
+      }
+      check(!get_pool(pool).frozen, "pool is frozen");
+      assetsa assettable(get_self(), pool.value);
+      auto by_cs = assettable.get_index<"bycontrsym"_n>();
+      auto ain = by_cs.find(contract_sym_key(tkcontract, quantity.symbol.code()));
+      check(ain != by_cs.end(), "unrecog transfer token contract & symbol");
+      check(ain->token_id == in_token_id, "transfer token mismatched to prep");
+      check(ain->active, "input token swap is frozen");
+      uint64_t in_bal_before = ain->balance.value().amount;
+      check(in_bal_before > 0, "zero input balance, can't compute swap");                
+      auto aout = assettable.require_find(out_token_id, "unrecog output token id");
+      out_contract = aout->contract_name;
+      check(aout->active, "output token swap is frozen");
+      uint64_t out_bal_before = aout->balance.value().amount;
+      // marginal pool price of the output token in input token units;
+      // resting orders at or below it are filled before the curve
+      double spot_price = out_bal_before == 0 ? 0.0 :
+        (double)in_bal_before * aout->weight / ((double)out_bal_before * ain->weight) * price_scale;
+      orders ordertable(get_self(), pool.value);
+      int64_t curve_in = 0, curve_out = 0;
+
+      if (input_is_exact) {
+        uint64_t in_amount64 = amount_from(ain->balance.value().symbol, prep_amount);
+        check(in_amount64 == quantity.amount, "transfer qty mismatched to prep");
+        curve_in = in_amount64;
+        int64_t order_out = fill_orders(ordertable, *ain, *aout, spot_price, true, curve_in);
+
+        if (curve_in > 0) {
+          // do balancer computation 
+          double lc, lnc;
+          int64_t in_bal_after, out_bal_after;
+          in_bal_after = in_bal_before + curve_in;
+          lc = log((double)in_bal_after/in_bal_before);
+          lnc = -(ain->weight/aout->weight * lc);
+          out_bal_after = llround(out_bal_before * exp(lnc));
+          curve_out = out_bal_before - out_bal_after;
         }
 
-        double lc, lnc;
-        int64_t in_bal_after, out_bal_after, computed_amt;
-        out_bal_after = out_bal_before - out_amount64;
-        check(out_bal_after > 0, "insufficient pool bal output token");
-        lc = log((double)out_bal_after/out_bal_before);
-        lnc = -(aout->weight/ain->weight * lc);
-        in_bal_after = llround(in_bal_before * exp(lnc));
-        computed_amt = in_bal_after - in_bal_before;
+        out_qty = asset(order_out + curve_out, aout->balance.value().symbol);
+        
+      } else { // output quantity is exact
+        uint64_t out_amount64 = amount_from(aout->balance.value().symbol, prep_amount);
+        curve_out = out_amount64;
+        int64_t order_in = fill_orders(ordertable, *ain, *aout, spot_price, false, curve_out);
+
+        if (curve_out > 0) {
+          double lc, lnc;
+          int64_t in_bal_after, out_bal_after;
+          out_bal_after = out_bal_before - curve_out;
+          check(out_bal_after > 0, "insufficient pool bal output token");
+          lc = log((double)out_bal_after/out_bal_before);
+          lnc = -(aout->weight/ain->weight * lc);
+          in_bal_after = llround(in_bal_before * exp(lnc));
+          curve_in = in_bal_after - in_bal_before;
+        }
         
-        in_surplus = quantity.amount - computed_amt;
+        in_surplus = quantity.amount - order_in - curve_in;
         check(in_surplus >= 0, "insufficient amount transferred in");
-        out_qty = asset(out_amount64, stout->supply.symbol);
+        out_qty = asset(out_amount64, aout->balance.value().symbol);
 
       }
+      // the pool keeps what the curve was paid; order fills went to the makers
+      assettable.modify(*ain, same_payer, [&](auto& s) {
+        s.balance.value().amount += curve_in;
+      });
+      assettable.modify(aout, same_payer, [&](auto& s) {
+        s.balance.value().amount -= curve_out;
+      });
+      opReceipt r{ "swap"_n, pool, sender, recipient, ain->token_id, aout->token_id,
+                   asset(quantity.amount - in_surplus, quantity.symbol), out_qty,
+                   asset(in_bal_before, ain->balance.value().symbol), ain->balance.value(),
+                   asset(out_bal_before, aout->balance.value().symbol), aout->balance.value(),
+                   ain->weight, aout->weight };
     
       // send exchange output to recipient 
       action (
         permission_level{get_self(), "active"_n},
         out_contract,
         "transfer"_n,
-        std::make_tuple(get_self(), recipient, out_qty,
-          exchange_memo + " (from " + sender.to_string() + " via oswaps)")
+        std::make_tuple(get_self(), recipient, out_qty, exchange_memo)
       ).send();
       // refund surplus to sender
       if(in_surplus > 0) {
         asset overpayment = asset(in_surplus, quantity.symbol);
-        asset netpayment = asset(quantity.amount-in_surplus, quantity.symbol);
         action (
           permission_level{get_self(), "active"_n},
           tkcontract,
           "transfer"_n,
           std::make_tuple(get_self(), sender, overpayment,
-            std::string("oswaps exchange refund overpayment, net is ")+netpayment.to_string())
+            std::string("oswaps exchange refund overpayment"))
         ).send();
       }
+      send_receipt(r);
     } else {
       check(false, "malformed oswaps trx: invalid prep action");
     }
@@ -558,6 +1173,7 @@ void oswaps::sub_balance( const name& owner, const asset& value ) {
    from_acnts.modify( from, same_payer, [&]( auto& a ) {
          a.balance -= value;
       });
+   sync_holder( owner, from.balance, same_payer );
 }
 
 void oswaps::add_balance( const name& owner, const asset& value, const name& ram_payer )
@@ -565,7 +1181,7 @@ void oswaps::add_balance( const name& owner, const asset& value, const name& ram
    accounts to_acnts( get_self(), owner.value );
    auto to = to_acnts.find( value.symbol.code().raw() );
    if( to == to_acnts.end() ) {
-      to_acnts.emplace( ram_payer, [&]( auto& a ){
+      to = to_acnts.emplace( ram_payer, [&]( auto& a ){
         a.balance = value;
       });
    } else {
@@ -573,6 +1189,30 @@ void oswaps::add_balance( const name& owner, const asset& value, const name& ram
         a.balance += value;
       });
    }
+   sync_holder( owner, to->balance, ram_payer );
+}
+
+void oswaps::sync_holder( const name& owner, const asset& balance, const name& ram_payer )
+{
+   if( owner == get_self() ) { // transient balance during issue and retire
+      return;
+   }
+   holders hldrs( get_self(), balance.symbol.code().raw() );
+   auto h = hldrs.find( owner.value );
+   if( balance.amount == 0 ) {
+      if( h != hldrs.end() ) {
+         hldrs.erase( h );
+      }
+   } else if( h == hldrs.end() ) {
+      hldrs.emplace( ram_payer == same_payer ? get_self() : ram_payer, [&]( auto& s ){
+        s.account = owner;
+        s.balance = balance;
+      });
+   } else {
+      hldrs.modify( h, same_payer, [&]( auto& s ) {
+        s.balance = balance;
+      });
+   }
 }
 
 void oswaps::retire( const asset& quantity, const string& memo )
@@ -2,6 +2,7 @@
 #include <eosio/eosio.hpp>
 #include <eosio/crypto.hpp>
 #include <eosio/singleton.hpp>
+#include <eosio/system.hpp>
 #include <eosio/transaction.hpp>
 #include <algorithm>
 
@@ -42,6 +43,14 @@ using std::string;
     *   Future expansion TBD, may involve adding new fields to the asset table or
     *   adding a supplementary table.
     *
+    * Assets are grouped into independent pools. Each pool has its own asset table scope,
+    *   balancer weights, freeze state and manager; a swap only involves assets of one
+    *   pool. The pool balance of each asset is tracked in its asset table row, so the
+    *   same token may be registered in several pools. The default pool is scoped to
+    *   the contract account and is managed by the contract manager; pool-related
+    *   action parameters may be omitted to address it. Token ids (and therefore LIQ
+    *   token symbols) are unique across all pools.
+    *
     * Authorization model
     * The contract account owner permission should be a "cold" multisig which is used once for
     *   uploading the contract and once for specifying a manager account. It has no
@@ -67,7 +76,7 @@ CONTRACT oswaps : public contract {
  
       /**
           * This action clears the `accounts` table for a particular account. All
-          * token balances in the account are erased.
+          * token balances in the account are erased, along with its `holders` rows.
           *
           * @param account - account
           *
@@ -91,8 +100,10 @@ CONTRACT oswaps : public contract {
           * @param actor - an account empowered to execute the freeze action
           * @param token_id - a numerical token identifier in the asset table
           * @param symbol - the symbol of the affected token
+          * @param pool - the pool (omitted: the default pool)
       */
-      ACTION freeze(name actor, uint64_t token_id, string symbol);
+      ACTION freeze(name actor, uint64_t token_id, string symbol,
+                    const binary_extension<name>& pool);
 
       /**
           * The `unfreeze` action executed by the manager or other authorized actor enables
@@ -101,8 +112,59 @@ CONTRACT oswaps : public contract {
           * @param actor - an account empowered to execute the freeze action
           * @param token_id - a numerical token identifier in the asset table
           * @param symbol - the symbol of the affected token
+          * @param pool - the pool (omitted: the default pool)
+      */
+      ACTION unfreeze(name actor, uint64_t token_id, string symbol,
+                      const binary_extension<name>& pool);
+
+      /**
+          * The `createpool` action executed by the manager creates a new, empty pool
+          *   and assigns it a manager, who is empowered to execute freeze, unfreeze,
+          *   forgetasset, withdraw and setratelimit actions within the pool.
+          *
+          * @param pool - a name identifying the pool; it is also the asset table scope
+          * @param manager - the pool manager account
+      */
+      ACTION createpool(name pool, name manager);
+
+      /**
+          * The `freezepool` action executed by the pool manager suspends or enables
+          *   all transactions in a pool, independently of the per-token freeze state.
+          *
+          * @param actor - the pool manager
+          * @param pool - the pool
+          * @param freeze - true = freeze, false = enable transactions
+      */
+      ACTION freezepool(name actor, name pool, bool freeze);
+
+      /**
+          * The `resetpool` action executed by the oswaps contract account deletes the
+          *   asset table data of one pool, leaving other pools untouched. At most `limit`
+          *   assets are removed per action; when the pool is empty the pool itself is
+          *   removed.
+          *
+          * @param pool - the pool
+          * @param limit - max number of assets to remove (for time control)
       */
-      ACTION unfreeze(name actor, uint64_t token_id, string symbol);
+      ACTION resetpool(name pool, uint32_t limit);
+
+      /**
+          * The one-time `backfill` action executed by the oswaps contract account brings
+          *   asset rows written before the `bycontrsym` index and the `balance` field
+          *   existed up to date, so existing deployments can upgrade without a reset.
+          *   Each such row is rewritten, which creates its missing index entries, and
+          *   its token contract is counted in the `tkcontracts` registry. A missing
+          *   `balance` is filled from oswaps' holding in the token contract. Only the
+          *   default pool can hold such rows. Until it completes, pool actions abort
+          *   on legacy rows, and a deposit for a prep fails if its token contract is
+          *   not yet registered.
+          *
+          * @param cursor - the first token id to visit
+          * @param limit - max number of asset rows visited (for time control)
+          *
+          * @return - the token id to pass as `cursor` to the next call, or 0 when done
+      */
+      [[eosio::action]] uint64_t backfill(uint64_t cursor, uint32_t limit);
       
 
     typedef struct statusEntry {
@@ -114,14 +176,86 @@ CONTRACT oswaps : public contract {
       std::vector<statusEntry> status_entries;
     } poolStatus;
     
+    // fixed-layout record of a completed pool operation, see `receipt`
+    typedef struct opReceipt {
+      name kind; // swap, addliq, withdraw or wddropped
+      name pool;
+      name sender; // account which sent tokens in
+      name recipient; // account which received tokens out
+      uint64_t in_token_id;
+      uint64_t out_token_id;
+      asset in_quantity; // for withdraw: LIQ tokens returned
+      asset out_quantity; // for addliq: LIQ tokens issued
+      asset in_balance_before; // pool balances of the in and out tokens
+      asset in_balance_after;
+      asset out_balance_before;
+      asset out_balance_after;
+      float in_weight; // weights after the operation
+      float out_weight;
+    } opReceipt;
+
+      /**
+          * The `receipt` action is sent inline by the contract itself after each swap,
+          *   liquidity addition and withdrawal. It has no effect; its data records the
+          *   operation in a fixed binary layout, so indexers can read results directly
+          *   from action traces instead of parsing transfer memos.
+          * For addliq and withdraw operations the in and out token ids are the same
+          *   pool asset, with the LIQ token on the other side of the quantities.
+          * A queued withdrawal dropped by `process` gets a wddropped receipt with
+          *   the requested quantity as out_quantity and unchanged balances.
+          *
+          * @param r - the operation receipt
+      */
+      ACTION receipt(const opReceipt& r);
+
       /**
           * The `querypool` action returns an array reporting on the balances and
           *   weights in the pool. This informations is intended to enable the caller
           *   to compute the exchange rate for an upcoming transaction.
           *
-          * @param token_id_list - an array of numerical token identifiers 
+          * @param token_id_list - an array of numerical token identifiers; if empty,
+          *   all assets in the pool are reported (i.e. a pool snapshot)
+          * @param pool - the pool (omitted: the default pool)
+      */
+      [[eosio::action, eosio::read_only]] oswaps::poolStatus querypool(
+              std::vector<uint64_t> token_id_list, const binary_extension<name>& pool);
+
+      /**
+          * The `getassetid` action resolves a token, identified by its contract and
+          *   symbol, to its numerical identifier in the asset table. It enables callers
+          *   to look up an asset from the fields of a token transfer.
+          *
+          * @param contract - the token contract name
+          * @param symbol - the symbol of the token
+          * @param pool - the pool (omitted: the default pool)
+          *
+          * @result - the token_id for this asset
+      */
+      [[eosio::action, eosio::read_only]] uint64_t getassetid(
+              name contract, symbol_code symbol, const binary_extension<name>& pool);
+
+    typedef struct holderEntry {
+      name account;
+      asset balance;
+    } holderEntry;
+    typedef struct holderPage {
+      std::vector<holderEntry> holders;
+      name next; // cursor for the following page; empty name when done
+    } holderPage;
+
+      /**
+          * The `getholders` action lists the holders of a LIQ token with their
+          *   balances, in account name order. It reads the per-token holder table,
+          *   so its cost is linear in the number of holders returned.
+          *
+          * @param liq_symbol - the LIQ token symbol, e.g. LIQB
+          * @param cursor - the first account to report (empty name: from the start)
+          * @param limit - max number of holders to report (1..max_holder_page)
+          *
+          * @result - one page of holders and the cursor for the next page
       */
-      [[eosio::action, eosio::read_only]] oswaps::poolStatus querypool(std::vector<uint64_t> token_id_list);
+      [[eosio::action, eosio::read_only]] oswaps::holderPage getholders(
+              symbol_code liq_symbol, name cursor, uint32_t limit);
 
       /**
           * The `createasseta` creates an entry in the asset table for an
@@ -135,21 +269,35 @@ CONTRACT oswaps : public contract {
           * @param contract - the contract name
           * @param symbol - the symbol of the affected token
           * @param meta - metadata (JSON) 
+          * @param pool - the pool (omitted: the default pool)
           *
           * @result - the token_id for this asset
       */
       ACTION createasseta(
-              name actor, string chain, name contract, symbol_code symbol, string meta);
+              name actor, string chain, name contract, symbol_code symbol, string meta,
+              const binary_extension<name>& pool);
 
       /**
           * The `forgetasset` action removes an entry in the asset table. This does
           * not affect any token balance held by the contract.
+          * Resting orders selling the asset are refunded to their makers first, at most
+          *   max_process_limit per call; while any remain the asset is kept, and the
+          *   action should be repeated.
           *
           * @param actor - an account empowered remove the asset (manager account)
           * @param token_id - a numerical token identifier in the asset table
           * @param memo
+          * @param pool - the pool (omitted: the default pool)
       */
-      ACTION forgetasset(name actor, uint64_t token_id, string memo);
+      ACTION forgetasset(name actor, uint64_t token_id, string memo,
+                         const binary_extension<name>& pool);
+
+    // one token of a batched liquidity addition or withdrawal
+    typedef struct liqLeg {
+      uint64_t token_id;
+      string amount;
+      float weight; // new balancer weight, or zero to keep the exchange rate
+    } liqLeg;
 
       /**
           * The `withdraw` action withdraws liquidity while simultaneously
@@ -158,15 +306,58 @@ CONTRACT oswaps : public contract {
           * which leaves the exchange rate unchanged. If the parameter is non-zero,
           * (i.e. price is being changed) the token will be frozen until it is
           * re-activated by the manager with an unfreeze action.
-          * [future: Token transfers occur through a rate-throttling queue which may
-          *    introduce delays]
+          * If the token has a rate limit (see `setratelimit`), the withdrawal is placed
+          *   in a queue and is carried out later by the `process` action; otherwise
+          *   it is carried out immediately.
           * 
           * @param account - the account receiving the tokens
           * @param token_id - a numerical token identifier in the asset table
           * @param amount - the amount of asset (quantity, symbol) to withdraw from pool;
           * @param weight - the new balancer weight (or zero)
+          * @param pool - the pool (omitted: the default pool)
+      */
+      ACTION withdraw(name account, uint64_t token_id, string amount, float weight,
+                      const binary_extension<name>& pool);
+
+      /**
+          * The `withdrawmany` action performs the `withdraw` action for several tokens
+          *   of a pool in one call, with the same rate limit and weight semantics.
+          *
+          * @param account - the account receiving the tokens
+          * @param legs - (token_id, amount, weight) for each token, at most max_batch_legs
+          * @param pool - the pool (omitted: the default pool)
+      */
+      ACTION withdrawmany(name account, std::vector<liqLeg> legs,
+                          const binary_extension<name>& pool);
+
+      /**
+          * The `setratelimit` action executed by the manager limits the rate at which
+          *   queued withdrawals of a token are released. At most `max_amount` is
+          *   released in each window of `window_sec` seconds. (A single withdrawal
+          *   larger than `max_amount` is released alone in an otherwise unused window.)
+          * A zero `max_amount` removes the limit; subsequent withdrawals are immediate.
+          *
+          * @param actor - the manager account
+          * @param token_id - a numerical token identifier in the asset table
+          * @param max_amount - the amount of asset (quantity, symbol) released per window
+          * @param window_sec - the window length in seconds
+          * @param pool - the pool (omitted: the default pool)
       */
-      ACTION withdraw(name account, uint64_t token_id, string amount, float weight);
+      ACTION setratelimit(name actor, uint64_t token_id, string max_amount, uint32_t window_sec,
+                          const binary_extension<name>& pool);
+
+      /**
+          * The `process` action releases queued withdrawals, for each token in the order
+          *   they were requested, subject to the per-token rate limits. Anyone may execute it.
+          * At most `limit` queue entries are released or dropped, so the cpu cost of the
+          *   action is bounded. A token held back by its rate limit is skipped with one
+          *   index lookup, without counting toward `limit`, so it cannot starve other
+          *   tokens; its entries remain in the queue. Entries which can no longer be
+          *   satisfied (e.g. insufficient pool or LIQ balance) are dropped.
+          *
+          * @param limit - max number of queue entries to release or drop (1..max_process_limit)
+      */
+      ACTION process(uint32_t limit);
 
       /**
           * The `addliqprep` action adds liquidity while simultaneously
@@ -182,9 +373,26 @@ CONTRACT oswaps : public contract {
           * @param token_id - a numerical token identifier in the asset table
           * @param amount - the amount of asset (quantity, symbol) to add to pool;
           * @param weight - the new balancer weight (or zero)
+          * @param pool - the pool (omitted: the default pool)
       */
       ACTION addliqprep(name account, uint64_t token_id,
-                        string amount, float weight);
+                        string amount, float weight, const binary_extension<name>& pool);
+
+      /**
+          * The `addliqmulti` action adds liquidity for several tokens of a pool in one
+          *   transaction. It must be followed by one token transfer per leg, in leg order,
+          *   as the final actions of the transaction. Transfers are checked as they
+          *   arrive; when the last one arrives all weights are recomputed in a single
+          *   pass (with the same semantics as `addliqprep`) and the LIQ tokens for every
+          *   leg are credited directly to the account.
+          *
+          * @param account - the account sourcing the tokens
+          * @param legs - (token_id, amount, weight) for each token, at most max_batch_legs,
+          *   each token at most once
+          * @param pool - the pool (omitted: the default pool)
+      */
+      ACTION addliqmulti(name account, std::vector<liqLeg> legs,
+                         const binary_extension<name>& pool);
 
       /**
           * The `exprepfrom` and `exprepto` actions are functions describing a conversion
@@ -207,12 +415,13 @@ CONTRACT oswaps : public contract {
           * @param out_token_id - a numerical token identifier for the outgoing asset
           * @param in_amount - the incoming amount (quantity, symbol) 
           * @param memo
+          * @param pool - the pool (omitted: the default pool)
           *
           *
       */
       ACTION exprepfrom(
            name sender, name recipient, uint64_t in_token_id, uint64_t out_token_id,
-           string in_amount, string memo);
+           string in_amount, string memo, const binary_extension<name>& pool);
 
       /**
           * In the `exprepto` action call, the outgoing amount is specified and the incoming
@@ -224,11 +433,46 @@ CONTRACT oswaps : public contract {
           * @param out_token_id - a numerical token identifier for the outgoing asset
           * @param out_amount - the outgoing amount (quantity, symbol)
           * @param memo
+          * @param pool - the pool (omitted: the default pool)
           *
       */
       ACTION exprepto(
            name sender, name recipient, uint64_t in_token_id, uint64_t out_token_id,
-           string out_amount, string memo);
+           string out_amount, string memo, const binary_extension<name>& pool);
+
+      /**
+          * The `orderprep` action places a resting limit order in a pool. The maker offers
+          *   `sell_amount` of one pool asset and asks at least `buy_amount` of another in
+          *   return, at a fixed price. Like the other prep actions, it must be followed by
+          *   a transfer of exactly `sell_amount` to the contract, which is held in escrow
+          *   (outside the pool balance) until the order is filled or cancelled.
+          * During `exprepfrom` and `exprepto` swaps, orders selling the swap output token for
+          *   the input token are filled in price order before the balancer curve is used,
+          *   as long as their price is no worse than the pool's marginal price. At most
+          *   max_order_fills orders are filled per swap; the fill proceeds are transferred
+          *   directly to the makers.
+          * A maker may have at most max_maker_orders open orders in a pool, and an order
+          *   must offer at least min_order_ppm of the pool's balance of the sell token.
+          *
+          * @param maker - the account placing the order, which receives fill proceeds
+          * @param sell_token_id - a numerical token identifier for the offered asset
+          * @param buy_token_id - a numerical token identifier for the requested asset
+          * @param sell_amount - the offered amount (quantity, symbol)
+          * @param buy_amount - the requested amount (quantity, symbol) for the whole offer
+          * @param pool - the pool (omitted: the default pool)
+      */
+      ACTION orderprep(name maker, uint64_t sell_token_id, uint64_t buy_token_id,
+                       string sell_amount, string buy_amount, const binary_extension<name>& pool);
+
+      /**
+          * The `cancelorder` action removes a resting limit order and refunds its unfilled
+          *   remainder to the maker.
+          *
+          * @param maker - the account which placed the order
+          * @param order_id - the order id
+          * @param pool - the pool (omitted: the default pool)
+      */
+      ACTION cancelorder(name maker, uint64_t order_id, const binary_extension<name>& pool);
 
            
       /**
@@ -266,6 +510,9 @@ CONTRACT oswaps : public contract {
           *   (e.g. add liquidity, swap, ...)
           * If no recognized action preceded the transfer, the token is
           *   transferred into the contract account's balance.
+          * Outgoing transfers and transfers from token contracts with no registered
+          *   asset are ignored before any table other than the token contract
+          *   registry is read.
           *
           * @param from - token sender
           * @param to - token recipient
@@ -283,7 +530,14 @@ CONTRACT oswaps : public contract {
       uint64_t token_id;
       string amount;
       float weight;
-      EOSLIB_SERIALIZE( addliqprep_params, (account)(token_id)(amount)(weight) )
+      binary_extension<name> pool;
+      EOSLIB_SERIALIZE( addliqprep_params, (account)(token_id)(amount)(weight)(pool) )
+    };
+    struct addliqmulti_params {
+      name account;
+      std::vector<liqLeg> legs;
+      binary_extension<name> pool;
+      EOSLIB_SERIALIZE( addliqmulti_params, (account)(legs)(pool) )
     };
     struct exprepfrom_params {
       name sender;
@@ -292,8 +546,9 @@ CONTRACT oswaps : public contract {
       uint64_t out_token_id;
       string in_amount;
       string memo;
+      binary_extension<name> pool;
       EOSLIB_SERIALIZE( exprepfrom_params,
-        (sender)(recipient)(in_token_id)(out_token_id)(in_amount)(memo) )
+        (sender)(recipient)(in_token_id)(out_token_id)(in_amount)(memo)(pool) )
     };
     struct exprepto_params {
       name sender;
@@ -302,10 +557,21 @@ CONTRACT oswaps : public contract {
       uint64_t out_token_id;
       string out_amount;
       string memo;
+      binary_extension<name> pool;
       EOSLIB_SERIALIZE( exprepto_params,
-        (sender)(recipient)(in_token_id)(out_token_id)(out_amount)(memo) )
+        (sender)(recipient)(in_token_id)(out_token_id)(out_amount)(memo)(pool) )
 
     };
+    struct orderprep_params {
+      name maker;
+      uint64_t sell_token_id;
+      uint64_t buy_token_id;
+      string sell_amount;
+      string buy_amount;
+      binary_extension<name> pool;
+      EOSLIB_SERIALIZE( orderprep_params,
+        (maker)(sell_token_id)(buy_token_id)(sell_amount)(buy_amount)(pool) )
+    };
     struct transfer_params {
       name from;
       name to;
@@ -337,11 +603,20 @@ CONTRACT oswaps : public contract {
         name manager;
         checksum256 chain_id;
         uint64_t last_token_id;
-        bool withdraw_flag;
+        bool withdraw_flag; // unused, retained for table layout compatibility
       } config_row;
 
+      // pools other than the default pool
+      TABLE pooltype { // single table, scoped by contract account name
+        name pool;
+        name manager;
+        bool frozen;
+
+        uint64_t primary_key() const { return pool.value; }
+      };
+
       // types of antelope tokens
-      TABLE assettypea { // single table, scoped by contract account name
+      TABLE assettypea { // scoped by pool name
         uint64_t token_id;
         checksum256 chain_code;
         name contract_name;
@@ -349,27 +624,151 @@ CONTRACT oswaps : public contract {
         bool active;
         string metadata;
         float weight;
+        binary_extension<asset> balance; // pool balance held by the contract; legacy rows get it from `backfill`
         
         uint64_t primary_key() const { return token_id; }
         checksum256 by_chain() const { return chain_code; }
+        uint128_t by_contract_sym() const { return contract_sym_key(contract_name, symbol); }
       };
      
+      // withdrawal rate limits
+      TABLE ratelimit { // single table, scoped by contract account name
+        uint64_t token_id;
+        int64_t max_amount;
+        uint32_t window_sec;
+        time_point_sec window_start;
+        int64_t window_used;
+
+        uint64_t primary_key() const { return token_id; }
+      };
+
+      // queued withdrawals awaiting `process`
+      TABLE withdrawreq { // single table, scoped by contract account name
+        uint64_t id;
+        name account;
+        name pool;
+        uint64_t token_id;
+        asset quantity;
+        float weight;
+        time_point_sec queued_at;
+
+        uint64_t primary_key() const { return id; }
+        uint128_t by_token() const { return (uint128_t)token_id << 64 | id; }
+      };
+
+      // resting limit orders, escrowed outside the pool balance
+      TABLE limitorder { // scoped by pool name
+        uint64_t id;
+        name maker;
+        uint64_t sell_token_id;
+        uint64_t buy_token_id;
+        asset remaining; // unfilled amount of the sell token
+        uint64_t price; // buy units per sell unit (smallest units), times price_scale
+        time_point_sec placed;
+
+        uint64_t primary_key() const { return id; }
+        uint128_t by_pair_price() const { return order_key(sell_token_id, buy_token_id, price); }
+      };
+
+      // open orders per maker, bounding the RAM one account can tie up
+      TABLE ordercount { // scoped by pool name
+        name maker;
+        uint32_t count;
+
+        uint64_t primary_key() const { return maker.value; }
+      };
+
+      // LIQ token holders other than the contract, kept in sync with `accounts`
+      TABLE holder { // scoped by LIQ symbol code
+        name account;
+        asset balance;
+
+        uint64_t primary_key() const { return account.value; }
+        uint64_t by_balance() const { return balance.amount; }
+      };
+
+      // registry of token contracts with at least one registered asset
+      TABLE tokencontract { // single table, scoped by contract account name
+        name contract;
+        uint32_t asset_count;
+
+        uint64_t primary_key() const { return contract.value; }
+      };
+
       // for transient storage of prep action for immediately following transfer
       TABLE txtemp { // singleton, scoped by contract account name
         std::string txdata;
+        binary_extension<uint32_t> legs_done; // transfers already received for addliqmulti
 
         //uint64_t primary_key() const { return 0; } // single row
       };
 
       typedef eosio::singleton< "configs"_n, config > configs;
+      typedef eosio::multi_index<"pools"_n, pooltype> pools;
       typedef eosio::multi_index<"assetsa"_n, assettypea, indexed_by
                < "bychain"_n,
-                 const_mem_fun<assettypea, checksum256, &assettypea::by_chain > >
+                 const_mem_fun<assettypea, checksum256, &assettypea::by_chain > >,
+               indexed_by
+               < "bycontrsym"_n,
+                 const_mem_fun<assettypea, uint128_t, &assettypea::by_contract_sym > >
                > assetsa;
       typedef eosio::singleton< "tx"_n, txtemp >  txx;
+      typedef eosio::multi_index<"tkcontracts"_n, tokencontract> tokencontracts;
+      typedef eosio::multi_index<"ratelimits"_n, ratelimit> ratelimits;
+      typedef eosio::multi_index<"wdqueue"_n, withdrawreq, indexed_by
+               < "bytoken"_n,
+                 const_mem_fun<withdrawreq, uint128_t, &withdrawreq::by_token > >
+               > wdqueue;
+      typedef eosio::multi_index<"holders"_n, holder, indexed_by
+               < "bybalance"_n,
+                 const_mem_fun<holder, uint64_t, &holder::by_balance > >
+               > holders;
+      typedef eosio::multi_index<"orders"_n, limitorder, indexed_by
+               < "bypairprice"_n,
+                 const_mem_fun<limitorder, uint128_t, &limitorder::by_pair_price > >
+               > orders;
+      typedef eosio::multi_index<"ordercounts"_n, ordercount> ordercounts;
+
+      const uint32_t max_process_limit = 10; // don't use too much cpu time in one `process`
+      const uint32_t max_order_fills = 8; // limit orders filled in a single swap
+      const uint32_t max_maker_orders = 8; // open orders per maker in one pool
+      const uint32_t min_order_ppm = 100; // smallest order, relative to pool balance
+      const uint32_t max_holder_page = 100; // holders reported by one `getholders`
+      const uint32_t max_batch_legs = 8; // tokens in one `addliqmulti` or `withdrawmany`
+      static constexpr uint64_t price_scale = 1000000000;
 
       void sub_balance( const name& owner, const asset& value );
       void add_balance( const name& owner, const asset& value, const name& ram_payer );
-      void save_transaction(name entry, uint64_t token_id);
+      void sync_holder( const name& owner, const asset& balance, const name& ram_payer );
+      void save_transaction(name entry, uint64_t token_id, name pool);
+      void save_transaction(name entry, const std::vector<uint64_t>& token_ids, name pool);
+      void withdraw_one(assetsa& assettable, const pooltype& p, name account,
+                        uint64_t token_id, const string& amount, float weight);
+      void addliq_batch(const addliqmulti_params& mp);
+      bool release_withdrawal(assetsa& assettable, const assettypea& a,
+                              name account, const asset& qty, float weight);
+      assetsa::const_iterator erase_asset(assetsa& assettable, assetsa::const_iterator a);
+      pooltype get_pool(name pool);
+      int64_t fill_orders(orders& ordertable, const assettypea& ain, const assettypea& aout,
+                          double spot_price, bool input_is_exact, int64_t& remaining);
+      orders::const_iterator refund_order(orders& ordertable, orders::const_iterator o,
+                                          const string& memo);
+      void count_order(name pool, name maker, int32_t delta);
+      void require_pool_manager(name actor, name pool);
+      void send_receipt(const opReceipt& r);
+
+      name pool_scope(const binary_extension<name>& pool) const {
+        return pool.has_value() ? pool.value() : get_self();
+      }
+
+      // packed (contract, symbol) key, unique per registered asset
+      static uint128_t contract_sym_key(name contract, symbol_code symbol) {
+        return (uint128_t)contract.value << 64 | symbol.raw();
+      }
+
+      // orders grouped by (sell token, buy token) pair, ascending price within a pair
+      static uint128_t order_key(uint64_t sell_token_id, uint64_t buy_token_id, uint64_t price) {
+        return (uint128_t)(sell_token_id << 32 | buy_token_id) << 64 | price;
+      }
 };
 
@@ -57,11 +57,16 @@ void rainbows::create( const name&    issuer,
        check( cf.config_locked_until.time_since_epoch() < current_time_point().time_since_epoch(),
               "token reconfiguration is locked" );
        check( st.issuer == issuer, "mismatched issuer account" );
+       check( !cf.use_profiles.value_or( false ), "turn off profiles before reconfiguring" );
+       if( is_decaying( cf ) ) {
+          check( symbol_code( cred_limit_symbol ) == symbol_code(0), "cannot set credit limit with lazy demurrage" );
+          check( maximum_supply.amount <= (asset::max_amount >> 20), "max-supply too large for lazy demurrage" );
+       }
        if( st.supply.amount != 0 ) {
           check( sym == st.supply.symbol,
                  "cannot change symbol precision with outstanding supply" );
           //TBD: could support precision change by walking accounts table
-          check( maximum_supply.amount >= st.supply.amount,
+          check( maximum_supply.amount >= live_supply( st, decay_index( cf ) ),
                  "cannot reduce maximum below outstanding supply" );
        }
        statstable.modify (st, issuer, [&]( auto& s ) {
@@ -88,6 +93,7 @@ void rainbows::create( const name&    issuer,
     symbols symboltable( get_self(), get_self().value );
     symboltable.emplace( issuer, [&]( auto& s ) {
        s.symbolcode = sym.code();
+       s.issuer = issuer;
     });
     statstable.emplace( issuer, [&]( auto& s ) {
        s.supply.symbol = maximum_supply.symbol;
@@ -117,6 +123,136 @@ void rainbows::create( const name&    issuer,
     displaytable.set( new_display, issuer );
 }
 
+rainbows::token_page rainbows::tokens( const symbol_code& cursor,
+                                       const uint32_t& limit,
+                                       const name& issuer )
+{
+    check( limit > 0 && limit <= max_token_page, "tokens: limit out of range" );
+    token_page rv;
+    std::vector<symbol_code> page;
+    symbol_code next;
+    if( issuer == name() ) {
+       auto itr = symboltable.lower_bound( cursor.raw() );
+       for( ; itr != symboltable.end() && page.size() < limit; ++itr ) {
+          page.push_back( itr->symbolcode );
+       }
+       if( itr != symboltable.end() ) {
+          next = itr->symbolcode;
+       }
+    } else {
+       auto by_issuer = symboltable.get_index<"byissuer"_n>();
+       auto itr = by_issuer.lower_bound( (uint128_t)issuer.value<<64 | cursor.raw() );
+       for( ; itr != by_issuer.end() && itr->issuer.value_or() == issuer && page.size() < limit; ++itr ) {
+          page.push_back( itr->symbolcode );
+       }
+       if( itr != by_issuer.end() && itr->issuer.value_or() == issuer ) {
+          next = itr->symbolcode;
+       }
+    }
+    for( const auto& symbolcode : page ) {
+       auto sym_code_raw = symbolcode.raw();
+       token_info ti;
+       ti.symbolcode = symbolcode;
+       stats statstable( get_self(), sym_code_raw );
+       ti.stat = statstable.get( sym_code_raw );
+       configs configtable( get_self(), sym_code_raw );
+       ti.config = configtable.get();
+       displays displaytable( get_self(), sym_code_raw );
+       if( displaytable.exists() ) {
+          ti.json_meta = display_meta( displaytable.get() );
+       }
+       backs backingtable( get_self(), sym_code_raw );
+       for( const auto& bk : backingtable ) {
+          ti.backings.push_back( bk );
+       }
+       rv.tokens.push_back( ti );
+    }
+    rv.next = next;
+    return rv;
+}
+
+rainbows::solvency_page rainbows::solvency( const name& backing_contract,
+                                            const symbol& backing_symbol,
+                                            const symbol_code& cursor,
+                                            const uint32_t& limit )
+{
+    check( limit > 0 && limit <= max_token_page, "solvency: limit out of range" );
+    solvency_page rv;
+    const uint128_t key = (uint128_t)backing_symbol.raw()<<64 | backing_contract.value;
+    // escrows commonly back several tokens; read each balance once
+    std::vector<std::pair<name,asset>> escrow_balances;
+    auto itr = symboltable.lower_bound( cursor.raw() );
+    for( uint32_t visited = 0; itr != symboltable.end() && visited < limit; ++itr, ++visited ) {
+       auto sym_code_raw = itr->symbolcode.raw();
+       backs backingtable( get_self(), sym_code_raw );
+       auto by_backing = backingtable.get_index<"backingtoken"_n>();
+       auto bk = by_backing.lower_bound( key );
+       if( bk == by_backing.end() || bk->by_secondary() != key ) {
+          continue;
+       }
+       stats statstable( get_self(), sym_code_raw );
+       const auto& st = statstable.get( sym_code_raw );
+       for( ; bk != by_backing.end() && bk->by_secondary() == key; ++bk ) {
+          solvency_t sv;
+          sv.token = itr->symbolcode;
+          sv.backing_index = bk->index;
+          sv.escrow = bk->escrow;
+          sv.proportional = bk->proportional;
+          sv.reserve_fraction = bk->reserve_fraction;
+          auto cached = std::find_if( escrow_balances.begin(), escrow_balances.end(),
+                                      [&]( const auto& e ) { return e.first == bk->escrow; } );
+          if( cached == escrow_balances.end() ) {
+             asset balance = held_balance( backing_contract, bk->escrow, backing_symbol.code() );
+             if( balance.symbol != backing_symbol ) { // no balance row
+                balance = asset( 0, backing_symbol );
+             }
+             escrow_balances.push_back( { bk->escrow, balance } );
+             cached = escrow_balances.end() - 1;
+          }
+          sv.escrow_balance = cached->second;
+          sv.liability = st.supply.amount > 0 ? backing_for( *bk, st.supply ) : asset( 0, backing_symbol );
+          rv.backings.push_back( sv );
+       }
+    }
+    if( itr != symboltable.end() ) {
+       rv.next = itr->symbolcode;
+    }
+    // a shared escrow must cover the liabilities of every token it backs,
+    // including tokens outside this page
+    std::vector<std::pair<name,asset>> escrow_liabilities;
+    for( const auto& eb : escrow_balances ) {
+       escrow_liabilities.push_back( { eb.first, asset( 0, backing_symbol ) } );
+    }
+    for( auto tk = escrow_liabilities.empty() ? symboltable.end() : symboltable.begin();
+         tk != symboltable.end(); ++tk ) {
+       backs backingtable( get_self(), tk->symbolcode.raw() );
+       auto by_backing = backingtable.get_index<"backingtoken"_n>();
+       auto bk = by_backing.lower_bound( key );
+       if( bk == by_backing.end() || bk->by_secondary() != key ) {
+          continue;
+       }
+       stats statstable( get_self(), tk->symbolcode.raw() );
+       const auto& st = statstable.get( tk->symbolcode.raw() );
+       if( st.supply.amount <= 0 ) {
+          continue;
+       }
+       for( ; bk != by_backing.end() && bk->by_secondary() == key; ++bk ) {
+          auto el = std::find_if( escrow_liabilities.begin(), escrow_liabilities.end(),
+                                  [&]( const auto& e ) { return e.first == bk->escrow; } );
+          if( el != escrow_liabilities.end() ) {
+             el->second += backing_for( *bk, st.supply );
+          }
+       }
+    }
+    for( auto& sv : rv.backings ) {
+       sv.escrow_liability = std::find_if( escrow_liabilities.begin(), escrow_liabilities.end(),
+                                           [&]( const auto& e ) { return e.first == sv.escrow; } )->second;
+       sv.reserve_ppm = sv.escrow_liability.amount > 0 ?
+          (int64_t)((int128_t)sv.escrow_balance.amount*1000000/sv.escrow_liability.amount) : 0;
+    }
+    return rv;
+}
+
 void rainbows::sister_check(const string& sym_name, uint32_t precision) {
     symbol_code sym = symbol_code( sym_name );
     if( sym != symbol_code(0) ) {
@@ -126,6 +262,7 @@ void rainbows::sister_check(const string& sym_name, uint32_t precision) {
        configs configtable( get_self(), sym.raw() );
        auto cf = configtable.get();
        check( cf.transfers_frozen, sym_name+" token must be frozen" );
+       check( !is_compact( cf ), sym_name+" token may not use compact balances" );
     }
 }
 
@@ -139,12 +276,14 @@ void rainbows::approve( const symbol_code& symbolcode, const bool& reject_and_cl
     auto cf = configtable.get();
     displays displaytable( get_self(), sym_code_raw );
     if( reject_and_clear ) {
-       check( st.supply.amount == 0, "cannot clear with outstanding tokens" );
+       check( live_supply( st, decay_index( cf ) ) == 0, "cannot clear with outstanding tokens" );
+       drop_sisters( symbolcode, cf );
        backs backingtable( get_self(), sym_code_raw );
        for( auto itr = backingtable.begin(); itr != backingtable.end(); ) {
           itr = backingtable.erase(itr);
        }
        configtable.remove( );
+       release_meta( symbolcode, displaytable.get() );
        displaytable.remove( );
        statstable.erase( statstable.iterator_to(st) );
        symbols symboltable( get_self(), get_self().value );
@@ -178,6 +317,40 @@ void rainbows::setvaluation( const symbol_code& symbolcode,
     configtable.set( cf, cf.valuation_mgr.value() );
 }
 
+std::vector<rainbows::valuation_micro_t> rainbows::valuations( const std::vector<asset>& amounts )
+{
+    check( amounts.size() <= max_batch_count, "valuations: too many amounts" );
+    struct cached_valuation { symbol_code symbolcode; symbol sym; string currency; int64_t micro_per_token; };
+    std::vector<cached_valuation> cache; // configs read once per distinct token
+    std::vector<valuation_micro_t> rv;
+    for( const auto& amount : amounts ) {
+       auto sym = amount.symbol.code();
+       auto cv = std::find_if( cache.begin(), cache.end(), [&]( const auto& c ) {
+          return c.symbolcode == sym;
+       });
+       if( cv == cache.end() ) {
+          valuation_t v = get_valuation( get_self(), sym );
+          stats statstable( get_self(), sym.raw() );
+          const auto& st = statstable.get( sym.raw(), "token with symbol does not exist" );
+          double micro = v.valuation * 1000000.0;
+          check( std::isfinite( micro ) && fabs( micro ) <= asset::max_amount, "valuation out of range" );
+          cache.push_back( cached_valuation{ sym, st.supply.symbol, v.currency, (int64_t)llround( micro ) } );
+          cv = cache.end() - 1;
+       }
+       check( amount.symbol == cv->sym, "symbol precision mismatch" );
+       int128_t scale = 1;
+       for( uint8_t p = 0; p < amount.symbol.precision(); ++p ) {
+          scale *= 10;
+       }
+       int128_t product = (int128_t)amount.amount * cv->micro_per_token;
+       int128_t half = scale / 2;
+       int128_t value = product >= 0 ? (product + half) / scale : -((-product + half) / scale);
+       check( value <= asset::max_amount && value >= -asset::max_amount, "valuation out of range" );
+       rv.push_back( valuation_micro_t{ cv->currency, (int64_t)value } );
+    }
+    return rv;
+}
+
 void rainbows::setbacking( const asset&    token_bucket,
                       const asset&    backs_per_bucket,
                       const name&     backing_token_contract,
@@ -209,6 +382,7 @@ void rainbows::setbacking( const asset&    token_bucket,
     const auto& cf = configtable.get();
     check( cf.config_locked_until.time_since_epoch() < current_time_point().time_since_epoch(),
            "token reconfiguration is locked" );
+    check( !is_decaying( cf ), "cannot back a token with lazy demurrage" );
     backs backingtable( get_self(), sym_code_raw );
     int existing_backing_count = std::distance(backingtable.cbegin(),backingtable.cend());
     check( existing_backing_count <= max_backings_count, "max backings count exceeded" );
@@ -242,11 +416,49 @@ void rainbows::deletebacking( const uint64_t& back_index,
            "token reconfiguration is locked" );
     require_auth( st.issuer );
     if( st.supply.amount != 0 ) {
-        redeem_one_backing( bk, st.issuer, st.supply );
+        redeem_one_backing( bk, st.issuer, st.supply, st.supply );
     }
     backingtable.erase( bk );
 }
 
+void rainbows::setdecay( const symbol_code& symbolcode, const int64_t& ppm_per_week )
+{
+    auto sym_code_raw = symbolcode.raw();
+    stats statstable( get_self(), sym_code_raw );
+    const auto& st = statstable.get( sym_code_raw, "token with symbol does not exist" );
+    require_auth( st.issuer );
+    check( ppm_per_week >= 0 && ppm_per_week <= max_decay_ppm_per_week, "decay rate out of range" );
+    configs configtable( get_self(), sym_code_raw );
+    auto cf = configtable.get();
+    check( live_supply( st, decay_index( cf ) ) == 0, "cannot change decay with outstanding supply" );
+    check( cf.config_locked_until.time_since_epoch() < current_time_point().time_since_epoch(),
+           "token reconfiguration is locked" );
+    if( ppm_per_week != 0 ) {
+       check( cf.cred_limit == symbol_code(0), "cannot decay a token with credit limit" );
+       check( st.max_supply.amount <= (asset::max_amount >> 20), "max-supply too large for lazy demurrage" );
+       backs backingtable( get_self(), sym_code_raw );
+       check( backingtable.begin() == backingtable.end(), "cannot decay a backed token" );
+       check( cf.checkpoint_sec.value_or( 0 ) == 0, "cannot decay a token with checkpoints" );
+    }
+    // earlier extension fields must be present for the new ones to serialize
+    if( !cf.valuation_mgr.has_value() ) { cf.valuation_mgr = "eosio.null"_n; }
+    if( !cf.val_per_token.has_value() ) { cf.val_per_token = 1.00; }
+    if( !cf.ref_currency.has_value() ) { cf.ref_currency = string(""); }
+    cf.decay_ppm_per_week = ppm_per_week;
+    cf.decay_since = current_time_point();
+    configtable.set( cf, st.issuer );
+    // the index restarts at 1, so balances decayed below one unit become plain amounts again
+    int64_t residual = st.decay_supply.value_or( st.supply.amount );
+    statstable.modify( st, same_payer, [&]( auto& s ) {
+       s.supply.amount = residual;
+       if( ppm_per_week != 0 ) {
+          s.decay_supply = residual;
+       } else {
+          s.decay_supply.reset();
+       }
+    });
+}
+
 void rainbows::setdisplay( const symbol_code&  symbolcode,
                            const string&       json_meta )
 {
@@ -258,10 +470,102 @@ void rainbows::setdisplay( const symbol_code&  symbolcode,
     auto dt = displaytable.get();
     check( json_meta.size() <= 2048, "json metadata has more than 2048 bytes" );
     // TODO check json_meta string for safety, parse json, and check name length
-    dt.json_meta   = json_meta;
+    checksum256 hash = sha256( json_meta.data(), json_meta.size() );
+    if( dt.meta_hash.has_value() && dt.meta_hash.value() == hash ) {
+       return;
+    }
+    release_meta( symbolcode, dt );
+    metablobs blobtable( get_self(), get_self().value );
+    auto blob = blobtable.find( meta_key( hash ) );
+    if( blob == blobtable.end() ) {
+       blobtable.emplace( st.issuer, [&]( auto& b ){
+          b.id = meta_key( hash );
+          b.hash = hash;
+          b.json_meta = json_meta;
+          b.users = { symbolcode };
+       });
+    } else {
+       check( blob->hash == hash, "metadata key collision" );
+       // the newest user takes over the bill, so sharing never rides on another issuer's RAM
+       blobtable.modify( blob, st.issuer, [&]( auto& b ) {
+          b.users.push_back( symbolcode );
+       });
+    }
+    dt.json_meta   = "";
+    dt.meta_hash   = hash;
     displaytable.set( dt, st.issuer );
 }
 
+string rainbows::display_meta( const currency_display& dt )
+{
+    if( !dt.meta_hash.has_value() ) {
+       return dt.json_meta;
+    }
+    metablobs blobtable( get_self(), get_self().value );
+    return blobtable.get( meta_key( dt.meta_hash.value() ), "display metadata missing" ).json_meta;
+}
+
+checksum256 rainbows::display_hash( const currency_display& dt )
+{
+    if( dt.meta_hash.has_value() ) {
+       return dt.meta_hash.value();
+    }
+    return sha256( dt.json_meta.data(), dt.json_meta.size() );
+}
+
+void rainbows::release_meta( const symbol_code& token, const currency_display& dt )
+{
+    if( !dt.meta_hash.has_value() ) {
+       return;
+    }
+    metablobs blobtable( get_self(), get_self().value );
+    auto blob = blobtable.find( meta_key( dt.meta_hash.value() ) );
+    if( blob == blobtable.end() ) {
+       return;
+    }
+    auto user = std::find( blob->users.begin(), blob->users.end(), token );
+    if( user == blob->users.end() ) {
+       return;
+    }
+    if( blob->users.size() == 1 ) {
+       blobtable.erase( blob );
+       return;
+    }
+    name payer = same_payer;
+    if( user + 1 == blob->users.end() ) { // the paying user leaves; the next latest pays
+       symbol_code next = *(user - 1);
+       stats statstable( get_self(), next.raw() );
+       payer = statstable.get( next.raw(), "metadata user does not exist" ).issuer;
+       check( has_auth( payer ), "shared metadata: " + payer.to_string() +
+              " must authorize taking over its RAM" );
+    }
+    size_t pos = user - blob->users.begin();
+    blobtable.modify( blob, payer, [&]( auto& b ) {
+       b.users.erase( b.users.begin() + pos );
+    });
+}
+
+rainbows::metadata_page rainbows::metadata( const std::vector<symbol_code>& symbolcodes )
+{
+    check( symbolcodes.size() <= max_token_page, "metadata: too many tokens" );
+    metadata_page rv;
+    for( const auto& symbolcode : symbolcodes ) {
+       displays displaytable( get_self(), symbolcode.raw() );
+       if( !displaytable.exists() ) {
+          continue;
+       }
+       const auto dt = displaytable.get();
+       checksum256 hash = display_hash( dt );
+       rv.tokens.push_back( { symbolcode, hash } );
+       bool seen = std::any_of( rv.metas.begin(), rv.metas.end(),
+                                [&]( const auto& m ) { return m.hash == hash; } );
+       if( !seen ) {
+          rv.metas.push_back( { hash, display_meta( dt ) } );
+       }
+    }
+    return rv;
+}
+
 void rainbows::issue( const asset& quantity, const string& memo )
 {
     auto sym = quantity.symbol;
@@ -278,87 +582,273 @@ void rainbows::issue( const asset& quantity, const string& memo )
     check( quantity.amount >= 0, "must issue zero or positive quantity" );
 
     check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
-    check( quantity.amount <= st.max_supply.amount - st.supply.amount, "quantity exceeds available supply");
+    balance_mode mode = mode_of( cf );
+    check( quantity.amount <= st.max_supply.amount - live_supply( st, mode.index ),
+           "quantity exceeds available supply");
 
+    account_limits lim = read_limits( st.issuer, quantity.symbol, cf );
+    int64_t credit_increase = add_balance( st.issuer, quantity, st.issuer, lim.positive_limit, mode );
     statstable.modify( st, same_payer, [&]( auto& s ) {
        s.supply += quantity;
+       s.supply.amount += credit_increase;
+       add_decay_supply( s, to_decay_units( quantity.amount, mode.index ), mode.index );
     });
+    if( cf.transfers_frozen ) {
+       sync_profiles( quantity.symbol.code(), st.issuer, st.issuer );
+    }
 
     set_all_backings( st.issuer, quantity );
-    add_balance( st.issuer, quantity, st.issuer, cf.positive_limit );
+}
+
+void rainbows::issuemany( const symbol_code& symbolcode,
+                          const std::vector<std::pair<name,int64_t>>& recipients,
+                          const string& memo )
+{
+    check( memo.size() <= 256, "memo has more than 256 bytes" );
+    check( recipients.size() > 0 && recipients.size() <= max_batch_count, "issuemany: recipient count out of range" );
+    auto sym_code_raw = symbolcode.raw();
+    stats statstable( get_self(), sym_code_raw );
+    const auto& st = statstable.get( sym_code_raw, "token with symbol does not exist, create token before issue" );
+    configs configtable( get_self(), sym_code_raw );
+    const auto& cf = configtable.get();
+    check( cf.approved, "cannot issue until token is approved" );
+    require_auth( st.issuer );
+    balance_mode mode = mode_of( cf );
+    // each leg is checked like an issue followed by a transfer from the issuer
+    account_limits issuer_lim = read_limits( st.issuer, st.supply.symbol, cf );
+    asset total = asset( 0, st.supply.symbol );
+    int64_t credit_increase = 0;
+    int64_t stored_total = 0;
+    for( const auto& [to, amount] : recipients ) {
+       check( amount >= 0, "must issue zero or positive quantity" );
+       check( amount <= st.max_supply.amount - live_supply( st, mode.index ) - total.amount,
+              "quantity exceeds available supply");
+       check( is_account( to ), "to account does not exist");
+       account_limits to_lim = read_limits( to, st.supply.symbol, cf );
+       if( cf.membership && to != st.issuer ) {
+          check( to_lim.membership > 0, "to account must have membership");
+          check( issuer_lim.membership > 0, "from account must have membership");
+          bool vis_to_vis = to_lim.membership == VISITOR && issuer_lim.membership == VISITOR;
+          check( !vis_to_vis, "cannot transfer visitor to visitor");
+       }
+       require_recipient( to );
+       asset quantity = asset( amount, st.supply.symbol );
+       credit_increase += add_balance( to, quantity, st.issuer, to_lim.positive_limit, mode );
+       stored_total += to_decay_units( amount, mode.index );
+       if( cf.transfers_frozen ) {
+          sync_profiles( symbolcode, to, st.issuer );
+       }
+       total += quantity;
+    }
+    statstable.modify( st, same_payer, [&]( auto& s ) {
+       s.supply += total;
+       s.supply.amount += credit_increase;
+       add_decay_supply( s, stored_total, mode.index );
+    });
+    set_all_backings( st.issuer, total );
 }
 
 void rainbows::set_one_backing(
    const backing_stats& bk,
    const name& owner,
    const asset& quantity ) {
-    if( bk.backs_per_bucket.amount > 0 ) { 
-       asset backing_quantity = bk.backs_per_bucket;
-       backing_quantity.amount = (int64_t)((int128_t)quantity.amount*bk.backs_per_bucket.amount/bk.token_bucket.amount);
-       action(
-          permission_level{owner, "active"_n},
-          bk.backing_token_contract,
-          "transfer"_n,
-          std::make_tuple(owner,
-                          bk.escrow,
-                          backing_quantity,
-                          std::string("rainbow backing"))
-       ).send();
-    }
+    std::vector<backing_leg> legs;
+    add_backing_leg( legs, bk, backing_for( bk, quantity ), false );
+    send_backing_legs( legs, owner, true );
 }
 
 void rainbows::set_all_backings( const name& owner, const asset& quantity ) {
+    std::vector<backing_leg> legs;
+    issue_legs( quantity, legs );
+    send_backing_legs( legs, owner, true );
+}
+
+void rainbows::issue_legs( const asset& quantity, std::vector<backing_leg>& legs ) {
     backs backingtable( get_self(), quantity.symbol.code().raw() );
     for( auto itr = backingtable.begin(); itr != backingtable.end(); itr++ ) {
-       set_one_backing( *itr, owner, quantity );
+       add_backing_leg( legs, *itr, backing_for( *itr, quantity ), false );
     }
 }
 
-void rainbows::redeem_one_backing( const backing_stats& bk, const name& owner, const asset& quantity ) {
-    // get balance in escrow
-    auto backing_in_escrow = get_balance( bk.backing_token_contract, bk.escrow, bk.backs_per_bucket.symbol.code() );
-    // backing proportion = (qty being redeemed)/(token supply)
-    uint64_t sym_code_raw = bk.token_bucket.symbol.code().raw();
-    stats statstable( get_self(), sym_code_raw );
-    const auto& st = statstable.get( sym_code_raw, "redeem backing: no symbol" );
-    check( st.supply.amount > 0, "no backing supply to redeem" );
-    int64_t proportional_amount = (int64_t)((int128_t)backing_in_escrow.amount*quantity.amount/st.supply.amount);
+asset rainbows::backing_for( const backing_stats& bk, const asset& quantity ) {
     asset backing_quantity = bk.backs_per_bucket;
-    string memo;
+    backing_quantity.amount = (int64_t)((int128_t)quantity.amount*bk.backs_per_bucket.amount/bk.token_bucket.amount);
+    return backing_quantity;
+}
+
+void rainbows::add_backing_leg( std::vector<backing_leg>& legs, const backing_stats& bk,
+                                const asset& backing_quantity, bool proportional ) {
+    // backings sharing (contract, escrow, symbol) move as one transfer
+    for( auto& leg : legs ) {
+       if( leg.contract == bk.backing_token_contract && leg.escrow == bk.escrow &&
+           leg.quantity.symbol == backing_quantity.symbol ) {
+          leg.quantity += backing_quantity;
+          leg.proportional &= proportional;
+          return;
+       }
+    }
+    legs.push_back( backing_leg{ bk.backing_token_contract, bk.escrow, backing_quantity, proportional } );
+}
+
+void rainbows::send_backing_legs( const std::vector<backing_leg>& legs, const name& owner, bool to_escrow ) {
+    for( const auto& leg : legs ) {
+       if( leg.quantity.amount <= 0 ) {
+          continue;
+       }
+       if( to_escrow ) {
+          action(
+             permission_level{owner, "active"_n},
+             leg.contract,
+             "transfer"_n,
+             std::make_tuple(owner,
+                             leg.escrow,
+                             leg.quantity,
+                             std::string("rainbow backing"))
+          ).send();
+       } else {
+          action(
+             permission_level{leg.escrow,"active"_n},
+             leg.contract,
+             "transfer"_n,
+             std::make_tuple(leg.escrow,
+                             owner,
+                             leg.quantity,
+                             std::string(leg.proportional ? "proportional rainbow redeem" : "rainbow redeem"))
+          ).send();
+       }
+    }
+}
+
+string rainbows::redemption_for( const backing_stats& bk, const asset& quantity,
+                                 int64_t supply, int64_t backing_in_escrow, asset& backing_quantity ) {
+    if( supply <= 0 ) {
+       return "no backing supply to redeem";
+    }
+    backing_quantity = bk.backs_per_bucket;
     if( bk.proportional) {
-       backing_quantity.amount = proportional_amount;
-       memo = "proportional ";
+       // backing proportion = (qty being redeemed)/(token supply)
+       backing_quantity.amount = (int64_t)((int128_t)backing_in_escrow*quantity.amount/supply);
     } else {
-       backing_quantity.amount = (int64_t)((int128_t)quantity.amount*bk.backs_per_bucket.amount/bk.token_bucket.amount);
+       backing_quantity = backing_for( bk, quantity );
        // check whether this redemption would put escrow below reserve fraction
-       auto backing_remaining = backing_in_escrow.amount - backing_quantity.amount;
-       auto supply_remaining = st.supply.amount - quantity.amount;
+       auto backing_remaining = backing_in_escrow - backing_quantity.amount;
+       auto supply_remaining = supply - quantity.amount;
        auto escrow_needed = (int64_t)((int128_t)supply_remaining*bk.reserve_fraction*bk.backs_per_bucket.amount/
                        (100*bk.token_bucket.amount));
        if( escrow_needed > backing_remaining ) {
-          check( false, "can't redeem, escrow underfunded in " +
+          return "can't redeem, escrow underfunded in " +
                  bk.backs_per_bucket.symbol.code().to_string() +
-                 " (" + std::to_string(bk.reserve_fraction) + "% reserve)" );
+                 " (" + std::to_string(bk.reserve_fraction) + "% reserve)";
        }
     }
-    memo += "rainbow redeem";
-    if( backing_quantity.amount > 0 ) {
-       action(
-          permission_level{bk.escrow,"active"_n},
-          bk.backing_token_contract,
-          "transfer"_n,
-          std::make_tuple(bk.escrow,
-                          owner,
-                          backing_quantity,
-                          memo)
-       ).send();
-    }
+    return "";
+}
+
+void rainbows::redeem_one_backing( const backing_stats& bk, const name& owner,
+                                   const asset& quantity, const asset& supply ) {
+    auto backing_in_escrow = held_balance( bk.backing_token_contract, bk.escrow, bk.backs_per_bucket.symbol.code() );
+    asset backing_quantity;
+    string error = redemption_for( bk, quantity, supply.amount, backing_in_escrow.amount, backing_quantity );
+    check( error.empty(), error );
+    std::vector<backing_leg> legs;
+    add_backing_leg( legs, bk, backing_quantity, bk.proportional );
+    send_backing_legs( legs, owner, false );
 }
-void rainbows::redeem_all_backings( const name& owner, const asset& quantity ) {
+
+void rainbows::redeem_all_backings( const name& owner, const asset& quantity, const asset& supply ) {
+    std::vector<backing_leg> legs;
+    string error = redeem_legs( quantity, supply, legs );
+    check( error.empty(), error );
+    send_backing_legs( legs, owner, false );
+}
+
+string rainbows::redeem_legs( const asset& quantity, const asset& supply, std::vector<backing_leg>& legs ) {
     backs backingtable( get_self(), quantity.symbol.code().raw() );
+    std::vector<backing_leg> escrow_balances; // read once per (contract, escrow, symbol)
     for( auto itr = backingtable.begin(); itr != backingtable.end(); itr++ ) {
-       redeem_one_backing( *itr, owner, quantity );
+       const auto& bk = *itr;
+       auto eb = std::find_if( escrow_balances.begin(), escrow_balances.end(), [&]( const auto& e ) {
+          return e.contract == bk.backing_token_contract && e.escrow == bk.escrow &&
+                 e.quantity.symbol.code() == bk.backs_per_bucket.symbol.code();
+       });
+       if( eb == escrow_balances.end() ) {
+          escrow_balances.push_back( backing_leg{ bk.backing_token_contract, bk.escrow,
+             held_balance( bk.backing_token_contract, bk.escrow, bk.backs_per_bucket.symbol.code() ), false } );
+          eb = escrow_balances.end() - 1;
+       }
+       // each row is evaluated against the escrow balance at the start of the action,
+       // as before, since the grouped transfers are executed after this action
+       asset backing_quantity;
+       string error = redemption_for( bk, quantity, supply.amount, eb->quantity.amount, backing_quantity );
+       if( !error.empty() ) {
+          return error;
+       }
+       add_backing_leg( legs, bk, backing_quantity, bk.proportional );
     }
+    return "";
+}
+
+rainbows::preview_t rainbows::preview( const name& action_name, const name& owner, const asset& quantity )
+{
+    preview_t rv;
+    auto sym_code_raw = quantity.symbol.code().raw();
+    stats statstable( get_self(), sym_code_raw );
+    auto st = statstable.find( sym_code_raw );
+    if( st == statstable.end() ) {
+       rv.error = "token with symbol does not exist";
+       return rv;
+    }
+    configs configtable( get_self(), sym_code_raw );
+    const auto& cf = configtable.get();
+    std::vector<backing_leg> legs;
+    if( !quantity.is_valid() || quantity.symbol != st->supply.symbol ) {
+       rv.error = "invalid quantity or symbol precision mismatch";
+    } else if( action_name == "issue"_n ) {
+       if( !cf.approved ) {
+          rv.error = "cannot issue until token is approved";
+       } else if( quantity.amount < 0 ) {
+          rv.error = "must issue zero or positive quantity";
+       } else if( quantity.amount > st->max_supply.amount - live_supply( *st, decay_index( cf ) ) ) {
+          rv.error = "quantity exceeds available supply";
+       } else {
+          issue_legs( quantity, legs );
+          for( const auto& leg : legs ) {
+             if( held_balance( leg.contract, st->issuer, leg.quantity.symbol.code() ).amount < leg.quantity.amount ) {
+                rv.error = "issuer backing balance insufficient in " + leg.quantity.symbol.code().to_string();
+                break;
+             }
+          }
+       }
+    } else if( action_name == "retire"_n ) {
+       bool redeem_unlocked = cf.redeem_locked_until.time_since_epoch() <
+                              current_time_point().time_since_epoch();
+       if( quantity.amount <= 0 ) {
+          rv.error = "must retire positive quantity";
+       } else if( redeem_unlocked && cf.transfers_frozen ) {
+          rv.error = "transfers are frozen";
+       } else if( !redeem_unlocked && owner != st->issuer ) {
+          rv.error = "bearer redeem is disabled";
+       } else if( token_balance( owner, quantity.symbol.code() ).amount < quantity.amount ) {
+          rv.error = "overdrawn balance";
+       } else {
+          rv.error = redeem_legs( quantity, st->supply, legs );
+       }
+    } else {
+       rv.error = "preview supports issue and retire";
+    }
+    if( !rv.error.empty() ) {
+       return rv;
+    }
+    bool to_escrow = action_name == "issue"_n;
+    name holder = to_escrow ? st->issuer : owner;
+    for( const auto& leg : legs ) {
+       if( leg.quantity.amount <= 0 ) {
+          continue;
+       }
+       rv.transfers.push_back( backing_transfer_t{ leg.contract,
+          to_escrow ? holder : leg.escrow, to_escrow ? leg.escrow : holder, leg.quantity } );
+    }
+    return rv;
 }
 
 void rainbows::retire( const name& owner, const asset& quantity,
@@ -371,12 +861,12 @@ void rainbows::retire( const name& owner, const asset& quantity,
     stats statstable( get_self(), sym.code().raw() );
     const auto& st = statstable.get( sym.code().raw(), "token with symbol does not exist" );
     configs configtable( get_self(), sym.code().raw() );
+    const auto& cf = configtable.get();
     require_auth( owner );
     check( quantity.is_valid(), "invalid quantity" );
     check( quantity.amount > 0, "must retire positive quantity" );
     check( quantity.symbol == st.supply.symbol, "symbol or precision mismatch" );
     if( do_redeem ) {
-        const auto& cf = configtable.get();
         if( cf.redeem_locked_until.time_since_epoch() <
               current_time_point().time_since_epoch() ) {
            check( !cf.transfers_frozen, "transfers are frozen");
@@ -384,12 +874,18 @@ void rainbows::retire( const name& owner, const asset& quantity,
            check( owner == st.issuer, "bearer redeem is disabled");
         }
 
-        redeem_all_backings( owner, quantity );
+        redeem_all_backings( owner, quantity, st.supply );
     }
-    sub_balance( owner, quantity, symbol_code(0) );
+    balance_mode mode = mode_of( cf );
+    int64_t credit_increase = sub_balance( owner, quantity, owner, 0, mode );
     statstable.modify( st, same_payer, [&]( auto& s ) {
        s.supply -= quantity;
+       s.supply.amount += credit_increase;
+       add_decay_supply( s, -to_decay_units( quantity.amount, mode.index ), mode.index );
     });
+    if( cf.transfers_frozen ) {
+       sync_profiles( quantity.symbol.code(), owner, owner );
+    }
 
 
 }
@@ -405,9 +901,9 @@ void rainbows:: garner( const name&        from,
     configs configtable( get_self(), symbolcode.raw() );
     const auto& cf = configtable.get();
     check( has_auth( cf.withdrawal_mgr ) && to == cf.withdraw_to, "only withdrawal_mgr can garner");
-    accounts from_acnts( get_self(), from.value );
-    const auto fr = from_acnts.find( symbolcode.raw() );
-    if( fr == from_acnts.end() || fr->balance.amount <= 0) {
+    check( !is_decaying( cf ), "token has lazy demurrage" );
+    const asset balance = token_balance( from, symbolcode );
+    if( balance.amount <= 0) {
         return;
     }
     check(ppm_per_week >= 0, "garner: ppm_per_week must be nonnegative"); // may have future use case
@@ -430,7 +926,7 @@ void rainbows:: garner( const name&        from,
         demurrage_ppm = elapsed_sec*(int128_t)ppm_per_week/secs_per_week;
       } 
     } 
-    const asset quantity = asset(fr->balance.amount*(int128_t)(demurrage_ppm+ppm_abs)/1000000LL, fr->balance.symbol);
+    const asset quantity = asset(balance.amount*(int128_t)(demurrage_ppm+ppm_abs)/1000000LL, balance.symbol);
     action(
         permission_level{cf.withdrawal_mgr,"active"_n},
         get_self(),
@@ -439,6 +935,71 @@ void rainbows:: garner( const name&        from,
       ).send();
 }
 
+void rainbows::garnerall( const symbol_code& symbolcode,
+                          const int64_t&     ppm_per_week,
+                          const uint32_t&    limit )
+{
+    check( limit > 0 && limit <= max_garner_batch, "garnerall: limit out of range" );
+    check( ppm_per_week >= 0, "garner: ppm_per_week must be nonnegative" );
+    auto sym_code_raw = symbolcode.raw();
+    stats statstable( get_self(), sym_code_raw );
+    const auto& st = statstable.get( sym_code_raw, "token with symbol does not exist" );
+    configs configtable( get_self(), sym_code_raw );
+    const auto& cf = configtable.get();
+    require_auth( cf.withdrawal_mgr );
+    check( !is_decaying( cf ), "token has lazy demurrage" );
+    balance_mode mode = mode_of( cf );
+    const uint64_t secs_per_week = 7*24*60*60;
+    time_point now = current_time_point();
+    garnerdates gdates( get_self(), sym_code_raw );
+    auto by_date = gdates.get_index<"bylastgarner"_n>();
+    asset total = asset( 0, st.supply.symbol );
+    for( uint32_t visited = 0; visited < limit; ++visited ) {
+       // a visited row moves to the end of the index, so the stalest is always first
+       auto gd = by_date.begin();
+       if( gd == by_date.end() || gd->last_garner >= now ) {
+          break;
+       }
+       if( gd->account != cf.withdraw_to ) {
+          balance_row ac( get_self(), gd->account, st.supply.symbol, mode.compact );
+          if( ac.amount() > 0 ) {
+             int32_t elapsed_sec = now.sec_since_epoch() - gd->last_garner.sec_since_epoch();
+             int64_t demurrage_ppm = elapsed_sec*(int128_t)ppm_per_week/secs_per_week;
+             // a long-unvisited holder can owe more than 100%; never take more than the balance
+             int64_t amount = std::min<int128_t>( ac.amount()*(int128_t)demurrage_ppm/1000000LL,
+                                                  ac.amount() );
+             if( amount > 0 ) { // holder ends at or above zero, so credit supply is unchanged
+                if( mode.checkpoint_sec ) {
+                   record_checkpoint( gd->account, symbolcode, ac.amount(), ac.amount() - amount,
+                                      mode, cf.withdrawal_mgr );
+                }
+                ac.set( ac.amount() - amount, cf.withdrawal_mgr );
+                total.amount += amount;
+                if( cf.transfers_frozen ) {
+                   sync_profiles( symbolcode, gd->account, cf.withdrawal_mgr );
+                }
+             }
+          }
+       }
+       by_date.modify( gd, same_payer, [&]( auto& a ) {
+          a.last_garner = now;
+       });
+    }
+    if( total.amount > 0 ) {
+       account_limits lim = read_limits( cf.withdraw_to, total.symbol, cf );
+       int64_t credit_increase = add_balance( cf.withdraw_to, total, cf.withdrawal_mgr, lim.positive_limit,
+                                              mode );
+       if( credit_increase != 0 ) {
+          statstable.modify( st, same_payer, [&]( auto& s ) {
+             s.supply.amount += credit_increase;
+          });
+       }
+       if( cf.transfers_frozen ) {
+          sync_profiles( symbolcode, cf.withdraw_to, cf.withdrawal_mgr );
+       }
+    }
+}
+
 void rainbows::transfer( const name&    from,
                       const name&    to,
                       const asset&   quantity,
@@ -462,6 +1023,9 @@ void rainbows::transfer( const name&    from,
     check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
     check( memo.size() <= 256, "memo has more than 256 bytes" );
 
+    // membership tier and limits of each party, one lookup each when profiled
+    account_limits from_lim = read_limits( from, quantity.symbol, cf );
+    account_limits to_lim = read_limits( to, quantity.symbol, cf );
     bool withdrawing = has_auth( cf.withdrawal_mgr ) && to == cf.withdraw_to;
     if (!withdrawing ) {
        require_auth( from );
@@ -469,99 +1033,642 @@ void rainbows::transfer( const name&    from,
           check( !cf.transfers_frozen, "transfers are frozen");
        }
        if( cf.membership) {
-          accounts to_acnts( get_self(), to.value );
-          auto to_mbr = to_acnts.find( cf.membership.raw() );
-          check( to_mbr != to_acnts.end() && to_mbr->balance.amount >0, "to account must have membership");
-          accounts from_acnts( get_self(), from.value );
-          auto from_mbr = from_acnts.find( cf.membership.raw() );
-          check( from_mbr != from_acnts.end() && from_mbr->balance.amount > 0, "from account must have membership");
-          bool vis_to_vis = to_mbr->balance.amount == VISITOR && from_mbr->balance.amount == VISITOR;
+          check( to_lim.membership > 0, "to account must have membership");
+          check( from_lim.membership > 0, "from account must have membership");
+          bool vis_to_vis = to_lim.membership == VISITOR && from_lim.membership == VISITOR;
           check( !vis_to_vis, "cannot transfer visitor to visitor");
        }
     }
 
     auto payer = has_auth( to ) ? to : from;
 
-    sub_balance( from, quantity, cf.cred_limit );
-    add_balance( to, quantity, payer, cf.positive_limit );
+    // credit created or extinguished by the two balance changes is applied
+    // to the supply in one write, and only when there is some
+    balance_mode mode = mode_of( cf );
+    // the withdrawal_mgr path runs without the sender's authority
+    name from_payer = withdrawing ? cf.withdrawal_mgr : from;
+    int64_t credit_increase = sub_balance( from, quantity, from_payer, from_lim.cred_limit, mode )
+                            + add_balance( to, quantity, payer, to_lim.positive_limit, mode );
+    if( credit_increase != 0 ) {
+       check( st.max_supply.amount >= st.supply.amount + credit_increase, "new credit exceeds available supply");
+       statstable.modify( st, same_payer, [&]( auto& s ) {
+          s.supply.amount += credit_increase;
+       });
+    }
+    if( cf.transfers_frozen ) { // sister tokens are frozen; keep dependent profiles current
+       sync_profiles( quantity.symbol.code(), from, payer );
+       sync_profiles( quantity.symbol.code(), to, payer );
+    }
+
+}
+
+void rainbows::transfermany( const name&        from,
+                             const symbol_code& symbolcode,
+                             const std::vector<std::pair<name,int64_t>>& recipients,
+                             const string&      memo )
+{
+    check( recipients.size() > 0 && recipients.size() <= max_batch_count, "transfermany: recipient count out of range" );
+    check( memo.size() <= 256, "memo has more than 256 bytes" );
+    require_auth( from );
+    auto sym_code_raw = symbolcode.raw();
+    stats statstable( get_self(), sym_code_raw );
+    const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+    configs configtable( get_self(), sym_code_raw );
+    const auto& cf = configtable.get();
+    check( cf.approved, "token has not been approved" );
+    if( from != st.issuer ) {
+       check( !cf.transfers_frozen, "transfers are frozen");
+    }
+    account_limits from_lim = read_limits( from, st.supply.symbol, cf );
+    if( cf.membership ) {
+       check( from_lim.membership > 0, "from account must have membership");
+    }
+    require_recipient( from );
+
+    balance_mode mode = mode_of( cf );
+    asset total = asset( 0, st.supply.symbol );
+    int64_t credit_increase = 0;
+    int64_t stored_total = 0; // the sender loses exactly what the recipients gain
+    for( const auto& [to, amount] : recipients ) {
+       check( from != to, "cannot transfer to self" );
+       check( is_account( to ), "to account does not exist");
+       check( amount >= 0, "must transfer zero or positive quantity" );
+       account_limits to_lim = read_limits( to, st.supply.symbol, cf );
+       if( cf.membership ) {
+          check( to_lim.membership > 0, "to account must have membership");
+          bool vis_to_vis = to_lim.membership == VISITOR && from_lim.membership == VISITOR;
+          check( !vis_to_vis, "cannot transfer visitor to visitor");
+       }
+       require_recipient( to );
+       asset quantity = asset( amount, st.supply.symbol );
+       check( quantity.is_valid(), "invalid quantity" );
+       auto payer = has_auth( to ) ? to : from;
+       credit_increase += add_balance( to, quantity, payer, to_lim.positive_limit, mode );
+       if( cf.transfers_frozen ) {
+          sync_profiles( symbolcode, to, payer );
+       }
+       total += quantity;
+       stored_total += to_decay_units( amount, mode.index );
+    }
+    credit_increase += sub_balance( from, total, from, from_lim.cred_limit, mode, stored_total );
+    if( credit_increase != 0 ) {
+       check( st.max_supply.amount >= st.supply.amount + credit_increase, "new credit exceeds available supply");
+       statstable.modify( st, same_payer, [&]( auto& s ) {
+          s.supply.amount += credit_increase;
+       });
+    }
+    if( cf.transfers_frozen ) {
+       sync_profiles( symbolcode, from, from );
+    }
+}
+
+void rainbows::openstream( const name&           sender,
+                           const name&           recipient,
+                           const asset&          rate,
+                           const uint32_t&       period_sec,
+                           const time_point_sec& start,
+                           const time_point_sec& stop,
+                           const string&         memo )
+{
+    require_auth( sender );
+    check( sender != recipient, "cannot stream to self" );
+    check( is_account( recipient ), "recipient account does not exist");
+    check( memo.size() <= 256, "memo has more than 256 bytes" );
+    auto sym_code_raw = rate.symbol.code().raw();
+    stats statstable( get_self(), sym_code_raw );
+    const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+    configs configtable( get_self(), sym_code_raw );
+    const auto& cf = configtable.get();
+    check( cf.approved, "token has not been approved" );
+    check( rate.is_valid(), "invalid rate" );
+    check( rate.amount > 0, "rate must be positive" );
+    check( rate.symbol == st.supply.symbol, "symbol precision mismatch" );
+    check( period_sec > 0, "period must be positive" );
+    check( start >= time_point_sec( current_time_point() ), "stream cannot start in the past" );
+    check( stop > start, "stream must stop after it starts" );
+    uint32_t duration = stop.sec_since_epoch() - start.sec_since_epoch();
+    check( (int128_t)rate.amount*duration/period_sec <= st.max_supply.amount, "stream total exceeds max supply" );
+    require_recipient( recipient );
+    streams streamtable( get_self(), sym_code_raw );
+    streamtable.emplace( sender, [&]( auto& s ){
+       s.id = streamtable.available_primary_key();
+       s.sender = sender;
+       s.recipient = recipient;
+       s.rate = rate;
+       s.period_sec = period_sec;
+       s.start = start;
+       s.stop = stop;
+       s.paid = 0;
+    });
+}
+
+void rainbows::claimstream( const symbol_code& symbolcode, const uint64_t& id )
+{
+    streams streamtable( get_self(), symbolcode.raw() );
+    const auto& sm = streamtable.get( id, "stream does not exist" );
+    require_auth( sm.recipient );
+    int64_t paid = settle_stream( sm );
+    check( paid > 0, "nothing accrued since the last claim" );
+    streamtable.modify( sm, same_payer, [&]( auto& s ) {
+       s.paid += paid;
+    });
+}
 
-    stats statstable2( get_self(), sym_code_raw ); // use updated statstable for supply value
-    const auto& st2 = statstable2.get( sym_code_raw );
-    check( st2.max_supply.amount >= st2.supply.amount, "new credit exceeds available supply");
+void rainbows::closestream( const symbol_code& symbolcode, const uint64_t& id )
+{
+    streams streamtable( get_self(), symbolcode.raw() );
+    const auto& sm = streamtable.get( id, "stream does not exist" );
+    bool by_sender = has_auth( sm.sender );
+    if( !by_sender ) {
+       require_auth( sm.recipient );
+    }
+    settle_stream( sm, !by_sender );
+    streamtable.erase( sm );
+}
 
+int64_t rainbows::settle_stream( const stream& sm, bool partial )
+{
+    int64_t owed = stream_accrued( sm, time_point_sec( current_time_point() ) ) - sm.paid;
+    if( owed <= 0 ) {
+       return 0;
+    }
+    auto sym_code_raw = sm.rate.symbol.code().raw();
+    stats statstable( get_self(), sym_code_raw );
+    const auto& st = statstable.get( sym_code_raw );
+    configs configtable( get_self(), sym_code_raw );
+    const auto& cf = configtable.get();
+    account_limits from_lim = read_limits( sm.sender, st.supply.symbol, cf );
+    account_limits to_lim = read_limits( sm.recipient, st.supply.symbol, cf );
+    balance_mode mode = mode_of( cf );
+    if( partial ) {
+       bool allowed = sm.sender == st.issuer || !cf.transfers_frozen;
+       if( cf.membership ) {
+          allowed = allowed && to_lim.membership > 0 && from_lim.membership > 0 &&
+                    !( to_lim.membership == VISITOR && from_lim.membership == VISITOR );
+       }
+       if( !allowed ) {
+          return 0;
+       }
+       int128_t available = (int128_t)from_decay_units(
+          balance_row( get_self(), sm.sender, st.supply.symbol, mode.compact ).amount(), mode.index )
+          + from_lim.cred_limit;
+       int128_t room = (int128_t)to_lim.positive_limit - from_decay_units(
+          balance_row( get_self(), sm.recipient, st.supply.symbol, mode.compact ).amount(), mode.index );
+       owed = (int64_t)std::min<int128_t>( { owed, available, room } );
+       if( owed <= 0 ) {
+          return 0;
+       }
+    } else {
+       if( sm.sender != st.issuer ) {
+          check( !cf.transfers_frozen, "transfers are frozen");
+       }
+       if( cf.membership ) {
+          check( to_lim.membership > 0, "to account must have membership");
+          check( from_lim.membership > 0, "from account must have membership");
+          bool vis_to_vis = to_lim.membership == VISITOR && from_lim.membership == VISITOR;
+          check( !vis_to_vis, "cannot transfer visitor to visitor");
+       }
+    }
+    require_recipient( sm.sender );
+    require_recipient( sm.recipient );
+    auto payer = has_auth( sm.recipient ) ? sm.recipient : sm.sender;
+    asset quantity = asset( owed, st.supply.symbol );
+    int64_t credit_increase = sub_balance( sm.sender, quantity, payer, from_lim.cred_limit, mode )
+                            + add_balance( sm.recipient, quantity, payer, to_lim.positive_limit, mode );
+    if( credit_increase != 0 ) {
+       check( st.max_supply.amount >= st.supply.amount + credit_increase, "new credit exceeds available supply");
+       statstable.modify( st, same_payer, [&]( auto& s ) {
+          s.supply.amount += credit_increase;
+       });
+    }
+    if( cf.transfers_frozen ) {
+       sync_profiles( sm.rate.symbol.code(), sm.sender, payer );
+       sync_profiles( sm.rate.symbol.code(), sm.recipient, payer );
+    }
+    return owed;
+}
+
+int64_t rainbows::sub_balance( const name& owner, const asset& value, const name& ram_payer,
+                               int64_t limit, const balance_mode& mode ) {
+   // amounts are stored in decay-normalized units (identical unless lazily decaying)
+   return sub_balance( owner, value, ram_payer, limit, mode, to_decay_units( value.amount, mode.index ) );
 }
 
-void rainbows::sub_balance( const name& owner, const asset& value, const symbol_code& limit_symbol ) {
-   accounts from_acnts( get_self(), owner.value );
+int64_t rainbows::sub_balance( const name& owner, const asset& value, const name& ram_payer,
+                               int64_t limit, const balance_mode& mode, int64_t stored_value ) {
+   double index = mode.index;
+   balance_row from( get_self(), owner, value.symbol, mode.compact );
+   int64_t old_stored = from.amount();
+   if( stored_value > old_stored && from_decay_units( old_stored, index ) >= value.amount ) {
+      stored_value = old_stored; // rounding when spending the whole decayed balance
+   }
+   int64_t new_stored = old_stored - stored_value;
+   from.set( new_stored, ram_payer );
+   int64_t old_amount = from_decay_units( old_stored, index );
+   int64_t new_amount = from_decay_units( new_stored, index );
+   check( new_amount + limit >= 0, "overdrawn balance" );
+   if( mode.checkpoint_sec ) {
+      record_checkpoint( owner, value.symbol.code(), old_amount, new_amount, mode, ram_payer );
+   }
+   return std::min( old_amount, 0LL ) - std::min( new_amount, 0LL );
+}
 
-   int64_t limit = 0;
-   if( limit_symbol != symbol_code(0) ) {
-      auto cred = from_acnts.find( limit_symbol.raw() );
-      if( cred != from_acnts.end() ) {
-         const auto& lim = *cred;
-         check( lim.balance.symbol.precision() == value.symbol.precision(), "limit precision mismatch" );
-         limit = lim.balance.amount;
+int64_t rainbows::add_balance( const name& owner, const asset& value, const name& ram_payer,
+                               int64_t limit, const balance_mode& mode )
+{
+   double index = mode.index;
+   balance_row to( get_self(), owner, value.symbol, mode.compact );
+   int64_t stored_value = to_decay_units( value.amount, index );
+   if( !to.exists() ) {
+      check( limit >= value.amount, "transfer exceeds receiver positive limit" );
+      to.set( stored_value, ram_payer );
+      if( mode.checkpoint_sec ) {
+         record_checkpoint( owner, value.symbol.code(), 0, value.amount, mode, ram_payer );
       }
+      return 0;
    }
-   int64_t new_amount, old_amount;
-   const auto fr = from_acnts.find( value.symbol.code().raw() );
-   if( fr == from_acnts.end() ) {
-      old_amount = 0;
-      new_amount = -value.amount;
-      from_acnts.emplace( owner, [&]( auto& a ){
-        a.balance = asset{new_amount, value.symbol};
+   int64_t old_balance = from_decay_units( to.amount(), index );
+   int64_t new_stored = to.amount() + stored_value;
+   int64_t new_balance = from_decay_units( new_stored, index );
+   check( limit >= new_balance, "transfer exceeds receiver positive limit" );
+   int64_t credit_increase = std::min( old_balance, 0LL ) - std::min( new_balance, 0LL );
+   to.set( new_stored, ram_payer );
+   if( mode.checkpoint_sec ) {
+      record_checkpoint( owner, value.symbol.code(), old_balance, new_balance, mode, ram_payer );
+   }
+   return credit_increase;
+}
+
+rainbows::balance_mode rainbows::mode_of( const currency_config& cf )
+{
+   balance_mode mode;
+   mode.index = decay_index( cf );
+   mode.compact = is_compact( cf );
+   mode.checkpoint_sec = cf.checkpoint_sec.value_or( 0 );
+   if( mode.checkpoint_sec ) {
+      mode.checkpoint_since = time_point_sec( cf.checkpoint_since.value() );
+   }
+   return mode;
+}
+
+void rainbows::record_checkpoint( const name& owner, const symbol_code& token, int64_t old_amount,
+                                  int64_t new_amount, const balance_mode& mode, const name& ram_payer )
+{
+   checkpoints cptable( get_self(), owner.value );
+   auto by_token = cptable.get_index<"bytokentime"_n>();
+   uint32_t now = current_time_point().sec_since_epoch();
+   // a change takes effect in the history at the end of its epoch, so a balance
+   // read at an epoch boundary never sees changes made after it
+   time_point_sec epoch_end( now - now % mode.checkpoint_sec + mode.checkpoint_sec );
+   // latest checkpoint of this token
+   auto last = by_token.upper_bound( checkpoint_key( token, time_point_sec( UINT32_MAX ) ) );
+   bool has_last = false;
+   if( last != by_token.begin() ) {
+      --last;
+      has_last = last->token == token;
+   }
+   if( has_last && last->at.sec_since_epoch() > now ) { // at most one pending row per account
+      by_token.modify( last, same_payer, [&]( auto& c ) {
+         c.balance = new_amount;
       });
-   } else {
-      old_amount = fr->balance.amount;
-      new_amount = old_amount - value.amount;
-      from_acnts.modify( fr, same_payer, [&]( auto& a ) {
-         a.balance.amount = new_amount;
+      return;
+   }
+   if( !has_last && old_amount != 0 ) {
+      // first change since checkpoints were turned on: record the balance held until now
+      cptable.emplace( ram_payer, [&]( auto& c ){
+         c.id = cptable.available_primary_key();
+         c.token = token;
+         c.at = mode.checkpoint_since;
+         c.balance = old_amount;
       });
    }
-   check( new_amount + limit >= 0, "overdrawn balance" );
-   int64_t credit_increase = std::min( old_amount, 0LL ) - std::min( new_amount, 0LL );
-   stats statstable( get_self(), value.symbol.code().raw() );
-   const auto& st = statstable.get( value.symbol.code().raw() );
-   statstable.modify( st, same_payer, [&]( auto& s ) {
-      s.supply.amount += credit_increase;
+   cptable.emplace( ram_payer, [&]( auto& c ){
+      c.id = cptable.available_primary_key();
+      c.token = token;
+      c.at = epoch_end;
+      c.balance = new_amount;
    });
-   
 }
 
-void rainbows::add_balance( const name& owner, const asset& value, const name& ram_payer, const symbol_code& limit_symbol )
+rainbows::balance_row::balance_row( const name& self, const name& owner, const symbol& sym, bool compact )
+   : self( self ), owner( owner ), sym( sym ), compact( compact ),
+     acnts( self, owner.value ), it( acnts.end() ), citr( -1 ), camount( 0 )
 {
-   accounts to_acnts( get_self(), owner.value );
-   auto to = to_acnts.find( value.symbol.code().raw() );
-   int64_t limit = value.max_amount;
-   if( limit_symbol != symbol_code(0) ) {
-      auto pos = to_acnts.find( limit_symbol.raw() );
-      if( pos != to_acnts.end() ) {
-         const auto& lim = *pos;
-         check( lim.balance.symbol.precision() == value.symbol.precision(), "limit precision mismatch" );
-         limit = lim.balance.amount;
+   if( compact ) {
+      citr = internal_use_do_not_use::db_find_i64( self.value, owner.value, compact_table.value, sym.code().raw() );
+      if( citr >= 0 ) {
+         internal_use_do_not_use::db_get_i64( citr, &camount, sizeof(camount) );
       }
+   } else {
+      it = acnts.find( sym.code().raw() );
    }
-   if( to == to_acnts.end() ) {
-      check( limit >= value.amount, "transfer exceeds receiver positive limit" );
-      to_acnts.emplace( ram_payer, [&]( auto& a ){
-        a.balance = value;
+}
+
+void rainbows::balance_row::set( int64_t amount, const name& ram_payer )
+{
+   if( compact ) {
+      if( citr < 0 ) {
+         citr = internal_use_do_not_use::db_store_i64( owner.value, compact_table.value, ram_payer.value,
+                                                       sym.code().raw(), &amount, sizeof(amount) );
+      } else {
+         internal_use_do_not_use::db_update_i64( citr, same_payer.value, &amount, sizeof(amount) );
+      }
+      camount = amount;
+   } else if( it == acnts.end() ) {
+      it = acnts.emplace( ram_payer, [&]( auto& a ){
+        a.balance = asset{amount, sym};
       });
    } else {
-      int64_t new_balance = to->balance.amount + value.amount;
-      check( limit >= new_balance, "transfer exceeds receiver positive limit" );
-      int64_t credit_increase = std::min( to->balance.amount, 0LL ) - std::min( new_balance, 0LL );
-      to_acnts.modify( to, same_payer, [&]( auto& a ) {
-        a.balance.amount = new_balance;
-        a.balance.symbol = value.symbol;
+      acnts.modify( it, same_payer, [&]( auto& a ) {
+        a.balance.amount = amount;
+        a.balance.symbol = sym;
       });
-      stats statstable( get_self(), value.symbol.code().raw() );
-      const auto& st = statstable.get( value.symbol.code().raw() );
-      statstable.modify( st, same_payer, [&]( auto& s ) {
-         s.supply.amount += credit_increase;
-   });
+   }
+}
+
+void rainbows::balance_row::erase()
+{
+   if( compact ) {
+      internal_use_do_not_use::db_remove_i64( citr );
+      citr = -1;
+      camount = 0;
+   } else {
+      acnts.erase( it );
+      it = acnts.end();
+   }
+}
 
+rainbows::account_limits rainbows::read_limits( const name& owner, const symbol& sym,
+                                                const currency_config& cf )
+{
+   if( cf.use_profiles.has_value() && cf.use_profiles.value() ) {
+      profiles profiletable( get_self(), owner.value );
+      auto pf = profiletable.find( sym.code().raw() );
+      if( pf != profiletable.end() && pf->epoch.value_or( 0 ) == cf.profile_epoch.value_or( 0 ) ) {
+         return account_limits{ pf->membership, pf->cred_limit, pf->positive_limit };
+      }
+   }
+   // no profile row: read the sister token balances
+   account_limits rv{ 0, 0, asset::max_amount };
+   accounts acnts( get_self(), owner.value );
+   if( cf.membership ) {
+      auto mbr = acnts.find( cf.membership.raw() );
+      if( mbr != acnts.end() ) {
+         rv.membership = mbr->balance.amount;
+      }
+   }
+   if( cf.cred_limit ) {
+      auto cred = acnts.find( cf.cred_limit.raw() );
+      if( cred != acnts.end() ) {
+         check( cred->balance.symbol.precision() == sym.precision(), "limit precision mismatch" );
+         rv.cred_limit = cred->balance.amount;
+      }
+   }
+   if( cf.positive_limit ) {
+      auto pos = acnts.find( cf.positive_limit.raw() );
+      if( pos != acnts.end() ) {
+         check( pos->balance.symbol.precision() == sym.precision(), "limit precision mismatch" );
+         rv.positive_limit = pos->balance.amount;
+      }
    }
-   
+   return rv;
+}
+
+void rainbows::sync_profiles( const symbol_code& sister, const name& owner, const name& ram_payer )
+{
+   sisters sistertable( get_self(), sister.raw() );
+   for( const auto& dep : sistertable ) {
+      refresh_profile( owner, dep.token, ram_payer );
+   }
+}
+
+void rainbows::refresh_profile( const name& owner, const symbol_code& token, const name& ram_payer )
+{
+   stats statstable( get_self(), token.raw() );
+   auto st = statstable.find( token.raw() );
+   if( st == statstable.end() ) { // dependent token has been cleared
+      return;
+   }
+   configs configtable( get_self(), token.raw() );
+   auto cf = configtable.get();
+   uint32_t epoch = cf.profile_epoch.value_or( 0 );
+   cf.use_profiles = false; // rebuild from balances
+   account_limits lim = read_limits( owner, st->supply.symbol, cf );
+   profiles profiletable( get_self(), owner.value );
+   auto pf = profiletable.find( token.raw() );
+   if( lim.membership == 0 && lim.cred_limit == 0 && lim.positive_limit == asset::max_amount ) {
+      if( pf != profiletable.end() ) {
+         profiletable.erase( pf );
+      }
+   } else if( pf == profiletable.end() ) {
+      profiletable.emplace( ram_payer, [&]( auto& p ){
+         p.token = token;
+         p.membership = lim.membership;
+         p.cred_limit = lim.cred_limit;
+         p.positive_limit = lim.positive_limit;
+         p.epoch = epoch;
+      });
+   } else {
+      profiletable.modify( pf, same_payer, [&]( auto& p ) {
+         p.membership = lim.membership;
+         p.cred_limit = lim.cred_limit;
+         p.positive_limit = lim.positive_limit;
+         p.epoch = epoch;
+      });
+   }
+}
+
+void rainbows::drop_sisters( const symbol_code& token, const currency_config& cf )
+{
+   for( const symbol_code& sister : { cf.membership, cf.cred_limit, cf.positive_limit } ) {
+      if( !sister ) {
+         continue;
+      }
+      sisters sistertable( get_self(), sister.raw() );
+      auto dep = sistertable.find( token.raw() );
+      if( dep != sistertable.end() ) {
+         sistertable.erase( dep );
+      }
+   }
+}
+
+void rainbows::setprofiles( const symbol_code& symbolcode, const bool& enable )
+{
+   auto sym_code_raw = symbolcode.raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "token with symbol does not exist" );
+   require_auth( st.issuer );
+   configs configtable( get_self(), sym_code_raw );
+   auto cf = configtable.get();
+   check( cf.config_locked_until.time_since_epoch() < current_time_point().time_since_epoch(),
+          "token reconfiguration is locked" );
+   const std::pair<symbol_code, uint8_t> roles[] = {
+      { cf.membership, MEMBERSHIP_ROLE }, { cf.cred_limit, CRED_LIMIT_ROLE }, { cf.positive_limit, POS_LIMIT_ROLE } };
+   if( !enable ) {
+      drop_sisters( symbolcode, cf );
+   }
+   for( const auto& [sister, role] : roles ) {
+      if( !sister || !enable ) {
+         continue;
+      }
+      sisters sistertable( get_self(), sister.raw() );
+      auto dep = sistertable.find( sym_code_raw );
+      if( dep == sistertable.end() ) {
+         sistertable.emplace( st.issuer, [&]( auto& s ){
+            s.token = symbolcode;
+            s.roles = role;
+         });
+      } else {
+         sistertable.modify( dep, same_payer, [&]( auto& s ) {
+            s.roles |= role;
+         });
+      }
+   }
+   // earlier extension fields must be present for the new one to serialize
+   if( !cf.valuation_mgr.has_value() ) { cf.valuation_mgr = "eosio.null"_n; }
+   if( !cf.val_per_token.has_value() ) { cf.val_per_token = 1.00; }
+   if( !cf.ref_currency.has_value() ) { cf.ref_currency = string(""); }
+   if( !cf.decay_ppm_per_week.has_value() ) { cf.decay_ppm_per_week = 0; }
+   if( !cf.decay_since.has_value() ) { cf.decay_since = current_time_point(); }
+   if( enable && !cf.use_profiles.value_or( false ) ) {
+      if( !cf.compact_balances.has_value() ) { cf.compact_balances = false; }
+      if( !cf.checkpoint_sec.has_value() ) { cf.checkpoint_sec = 0; }
+      if( !cf.checkpoint_since.has_value() ) { cf.checkpoint_since = time_point(); }
+      cf.profile_epoch = cf.profile_epoch.value_or( 0 ) + 1;
+   }
+   cf.use_profiles = enable;
+   configtable.set( cf, st.issuer );
+}
+
+void rainbows::syncprofile( const name& owner, const symbol_code& symbolcode, const name& ram_payer )
+{
+   require_auth( ram_payer );
+   configs configtable( get_self(), symbolcode.raw() );
+   const auto& cf = configtable.get();
+   check( cf.use_profiles.has_value() && cf.use_profiles.value(), "token does not use profiles" );
+   refresh_profile( owner, symbolcode, ram_payer );
+}
+
+void rainbows::setcompact( const symbol_code& symbolcode, const bool& enable )
+{
+   auto sym_code_raw = symbolcode.raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "token with symbol does not exist" );
+   require_auth( st.issuer );
+   check( st.supply.amount == 0, "cannot change balance storage with outstanding supply" );
+   configs configtable( get_self(), sym_code_raw );
+   auto cf = configtable.get();
+   check( cf.config_locked_until.time_since_epoch() < current_time_point().time_since_epoch(),
+          "token reconfiguration is locked" );
+   check( !cf.transfers_frozen, "cannot change balance storage of a frozen token" );
+   // earlier extension fields must be present for the new one to serialize
+   if( !cf.valuation_mgr.has_value() ) { cf.valuation_mgr = "eosio.null"_n; }
+   if( !cf.val_per_token.has_value() ) { cf.val_per_token = 1.00; }
+   if( !cf.ref_currency.has_value() ) { cf.ref_currency = string(""); }
+   if( !cf.decay_ppm_per_week.has_value() ) { cf.decay_ppm_per_week = 0; }
+   if( !cf.decay_since.has_value() ) { cf.decay_since = current_time_point(); }
+   if( !cf.use_profiles.has_value() ) { cf.use_profiles = false; }
+   cf.compact_balances = enable;
+   configtable.set( cf, st.issuer );
+}
+
+asset rainbows::balance( const name& owner, const symbol_code& symbolcode )
+{
+   return token_balance( owner, symbolcode );
+}
+
+asset rainbows::token_balance( const name& owner, const symbol_code& sym_code )
+{
+   configs configtable( get_self(), sym_code.raw() );
+   if( !configtable.exists() ) {
+      return null_asset;
+   }
+   const auto& cf = configtable.get();
+   // only the table of the current storage mode is read; rows left in the
+   // other table by an earlier mode carry no balance
+   asset balance;
+   if( !is_compact( cf ) ) {
+      accounts accountstable( get_self(), owner.value );
+      const auto ac = accountstable.find( sym_code.raw() );
+      if( ac == accountstable.end() ) {
+         return null_asset;
+      }
+      balance = ac->balance;
+   } else { // a compact-mode balance holds no symbol
+      int32_t citr = internal_use_do_not_use::db_find_i64( get_self().value, owner.value,
+                                                           compact_table.value, sym_code.raw() );
+      if( citr < 0 ) {
+         return null_asset;
+      }
+      stats statstable( get_self(), sym_code.raw() );
+      balance = asset( 0, statstable.get( sym_code.raw() ).supply.symbol );
+      internal_use_do_not_use::db_get_i64( citr, &balance.amount, sizeof(balance.amount) );
+   }
+   return asset( from_decay_units( balance.amount, decay_index( cf ) ), balance.symbol );
+}
+
+asset rainbows::held_balance( const name& token_contract_account, const name& owner,
+                              const symbol_code& sym_code )
+{
+   if( token_contract_account == get_self() ) {
+      return token_balance( owner, sym_code );
+   }
+   return get_balance( token_contract_account, owner, sym_code );
+}
+
+void rainbows::setcheckpts( const symbol_code& symbolcode, const uint32_t& epoch_sec )
+{
+   auto sym_code_raw = symbolcode.raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "token with symbol does not exist" );
+   require_auth( st.issuer );
+   check( epoch_sec > 0, "checkpoint epoch must be positive" );
+   configs configtable( get_self(), sym_code_raw );
+   auto cf = configtable.get();
+   check( cf.config_locked_until.time_since_epoch() < current_time_point().time_since_epoch(),
+          "token reconfiguration is locked" );
+   check( !is_decaying( cf ), "cannot keep checkpoints with lazy demurrage" );
+   // earlier extension fields must be present for the new ones to serialize
+   if( !cf.valuation_mgr.has_value() ) { cf.valuation_mgr = "eosio.null"_n; }
+   if( !cf.val_per_token.has_value() ) { cf.val_per_token = 1.00; }
+   if( !cf.ref_currency.has_value() ) { cf.ref_currency = string(""); }
+   if( !cf.decay_ppm_per_week.has_value() ) { cf.decay_ppm_per_week = 0; }
+   if( !cf.decay_since.has_value() ) { cf.decay_since = current_time_point(); }
+   if( !cf.use_profiles.has_value() ) { cf.use_profiles = false; }
+   if( !cf.compact_balances.has_value() ) { cf.compact_balances = false; }
+   if( cf.checkpoint_sec.value_or( 0 ) == 0 ) {
+      cf.checkpoint_since = current_time_point();
+   }
+   cf.checkpoint_sec = epoch_sec;
+   configtable.set( cf, st.issuer );
+}
+
+asset rainbows::balanceat( const name& owner, const symbol_code& symbolcode, const time_point_sec& at )
+{
+   auto sym_code_raw = symbolcode.raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "token with symbol does not exist" );
+   configs configtable( get_self(), sym_code_raw );
+   const auto& cf = configtable.get();
+   check( cf.checkpoint_sec.value_or( 0 ) != 0, "token does not keep checkpoints" );
+   check( at >= time_point_sec( cf.checkpoint_since.value() ), "no balance history before checkpoints were turned on" );
+   checkpoints cptable( get_self(), owner.value );
+   auto by_token = cptable.get_index<"bytokentime"_n>();
+   auto cp = by_token.upper_bound( checkpoint_key( symbolcode, at ) );
+   if( cp != by_token.begin() ) {
+      --cp;
+      if( cp->token == symbolcode ) {
+         return asset( cp->balance, st.supply.symbol );
+      }
+   }
+   // nothing recorded up to `at`: a later first checkpoint means the balance was zero,
+   // no checkpoint at all means the balance has not changed since they were turned on
+   auto first = by_token.lower_bound( checkpoint_key( symbolcode, time_point_sec( 0 ) ) );
+   if( first != by_token.end() && first->token == symbolcode ) {
+      return asset( 0, st.supply.symbol );
+   }
+   asset balance = token_balance( owner, symbolcode );
+   return balance.symbol == st.supply.symbol ? balance : asset( 0, st.supply.symbol );
 }
 
 void rainbows::open( const name& owner, const symbol_code& symbolcode, const name& ram_payer )
@@ -574,12 +1681,10 @@ void rainbows::open( const name& owner, const symbol_code& symbolcode, const nam
    stats statstable( get_self(), sym_code_raw );
    const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
    require_auth( st.issuer );
-   accounts acnts( get_self(), owner.value );
-   auto it = acnts.find( sym_code_raw );
-   if( it == acnts.end() ) {
-      acnts.emplace( ram_payer, [&]( auto& a ){
-        a.balance = asset{0, st.supply.symbol};
-      });
+   configs configtable( get_self(), sym_code_raw );
+   balance_row row( get_self(), owner, st.supply.symbol, is_compact( configtable.get() ) );
+   if( !row.exists() ) {
+      row.set( 0, ram_payer );
    }
 }
 
@@ -591,11 +1696,15 @@ void rainbows::close( const name& owner, const symbol_code& symbolcode )
    if( !has_auth( st.issuer ) ) {
       require_auth( owner );
    }
-   accounts acnts( get_self(), owner.value );
-   auto it = acnts.find( sym_code_raw );
-   check( it != acnts.end(), "Balance row already deleted or never existed. Action won't have any effect." );
-   check( it->balance.amount == 0, "Cannot close because the balance is not zero." );
-   acnts.erase( it );
+   configs configtable( get_self(), sym_code_raw );
+   const auto& cf = configtable.get();
+   balance_row row( get_self(), owner, st.supply.symbol, is_compact( cf ) );
+   check( row.exists(), "Balance row already deleted or never existed. Action won't have any effect." );
+   check( row.amount() == 0, "Cannot close because the balance is not zero." );
+   row.erase();
+   if( cf.transfers_frozen ) { // sister tokens are frozen; keep dependent profiles current
+      sync_profiles( symbolcode, owner, has_auth( st.issuer ) ? st.issuer : owner );
+   }
 }
 
 void rainbows::freeze( const symbol_code& symbolcode, const bool& freeze, const string& memo )
@@ -607,10 +1716,74 @@ void rainbows::freeze( const symbol_code& symbolcode, const bool& freeze, const
    auto cf = configtable.get();
    check( memo.size() <= 256, "memo has more than 256 bytes" );
    require_auth( cf.freeze_mgr );
+   if( !freeze ) {
+      // profile rows of dependent tokens are only refreshed by frozen-token transfers
+      sisters sistertable( get_self(), sym_code_raw );
+      check( sistertable.begin() == sistertable.end(), "cannot unfreeze a token used for profiles" );
+   }
    cf.transfers_frozen = freeze;
    configtable.set (cf, st.issuer );
 }
 
+rainbows::gc_report rainbows::gc( const symbol_code& symbolcode, const name& cursor,
+                                  const uint32_t& limit, const std::vector<name>& owners )
+{
+   check( limit > 0 && limit <= max_batch_count, "gc: limit out of range" );
+   check( owners.size() <= limit, "gc: more owners than limit" );
+   auto sym_code_raw = symbolcode.raw();
+   stats statstable( get_self(), sym_code_raw );
+   const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+   require_auth( st.issuer );
+   configs configtable( get_self(), sym_code_raw );
+   const auto& cf = configtable.get();
+   const int64_t account_row_bytes = ROW_OVERHEAD + ( is_compact( cf ) ? sizeof(int64_t) : sizeof(asset) );
+   const int64_t garner_row_bytes = ROW_OVERHEAD + sizeof(name) + sizeof(time_point) + INDEX64_OVERHEAD;
+   gc_report rv{ 0, 0, 0, name() };
+   garnerdates gdates( get_self(), sym_code_raw );
+   // returns true if the account no longer holds the token
+   auto sweep_account = [&]( const name& owner ) {
+      balance_row ac( get_self(), owner, st.supply.symbol, is_compact( cf ) );
+      if( !ac.exists() ) {
+         return true;
+      }
+      // rows of a frozen token stay, since dependent profiles are built from them
+      if( ac.amount() != 0 || cf.transfers_frozen ) {
+         return false;
+      }
+      ac.erase();
+      rv.accounts_erased++;
+      rv.ram_bytes_freed += account_row_bytes;
+      return true;
+   };
+   if( !owners.empty() ) {
+      for( const auto& owner : owners ) {
+         if( sweep_account( owner ) ) {
+            auto gd = gdates.find( owner.value );
+            if( gd != gdates.end() ) {
+               gdates.erase( gd );
+               rv.garnerdates_erased++;
+               rv.ram_bytes_freed += garner_row_bytes;
+            }
+         }
+      }
+      return rv;
+   }
+   auto gd = gdates.lower_bound( cursor.value );
+   for( uint32_t visited = 0; gd != gdates.end() && visited < limit; ++visited ) {
+      if( sweep_account( gd->account ) ) {
+         gd = gdates.erase( gd );
+         rv.garnerdates_erased++;
+         rv.ram_bytes_freed += garner_row_bytes;
+      } else {
+         ++gd;
+      }
+   }
+   if( gd != gdates.end() ) {
+      rv.next = gd->account;
+   }
+   return rv;
+}
+
 void rainbows::reset( const bool all, const uint32_t limit )
 {
   uint32_t counter= 0;
@@ -635,6 +1808,25 @@ void rainbows::resetacct( const name& account )
     while (itr != tbl.end()) {
       itr = tbl.erase(itr);
     }
+    profiles ptbl(get_self(),account.value);
+    auto pitr = ptbl.begin();
+    while (pitr != ptbl.end()) {
+      pitr = ptbl.erase(pitr);
+    }
+    checkpoints ctbl(get_self(),account.value);
+    auto cpitr = ctbl.begin();
+    while (cpitr != ctbl.end()) {
+      cpitr = ctbl.erase(cpitr);
+    }
+    // compact-mode balances
+    int32_t citr = internal_use_do_not_use::db_lowerbound_i64( get_self().value, account.value,
+                                                              compact_table.value, 0 );
+    while (citr >= 0) {
+      uint64_t pk;
+      int32_t next = internal_use_do_not_use::db_next_i64( citr, &pk );
+      internal_use_do_not_use::db_remove_i64( citr );
+      citr = next;
+    }
 }
 
 void rainbows::reset_one( const symbol_code symbolcode, const bool all, const uint32_t limit, uint32_t& counter )
@@ -642,11 +1834,17 @@ void rainbows::reset_one( const symbol_code symbolcode, const bool all, const ui
      auto scope = symbolcode.raw();
      {
        configs tbl(get_self(),scope);
+       if( tbl.exists() ) {
+         drop_sisters( symbolcode, tbl.get() );
+       }
        tbl.remove();
        if( ++counter > limit ) { goto CountedOut; }
      }
      {
        displays tbl(get_self(),scope);
+       if( tbl.exists() ) {
+         release_meta( symbolcode, tbl.get() );
+       }
        tbl.remove();
        if( ++counter > limit ) { goto CountedOut; }
      }
@@ -658,6 +1856,22 @@ void rainbows::reset_one( const symbol_code symbolcode, const bool all, const ui
          if( ++counter > limit ) { goto CountedOut; }
        }
      }
+     {
+       garnerdates tbl(get_self(),scope);
+       auto itr = tbl.begin();
+       while (itr != tbl.end()) {
+         itr = tbl.erase(itr);
+         if( ++counter > limit ) { goto CountedOut; }
+       }
+     }
+     {
+       streams tbl(get_self(),scope);
+       auto itr = tbl.begin();
+       while (itr != tbl.end()) {
+         itr = tbl.erase(itr);
+         if( ++counter > limit ) { goto CountedOut; }
+       }
+     }
      if( all ) {
        {
          stats tbl(get_self(),scope);
@@ -6,6 +6,7 @@
 #include <eosio/singleton.hpp>
 #include <eosio/system.hpp>
 
+#include <cmath>
 #include <string>
 
 
@@ -57,6 +58,13 @@ using namespace eosio;
     *
     * The `symbols` table is a housekeeping list of all the tokens managed by the contract. It is
     * scoped to the contract.
+    *
+    * For tokens configured with a credit limit (mutual credit), each account holds a single net
+    * balance against the community rather than bilateral debts to other members, and the credit
+    * portion of the supply is the sum of the negative balances. Debt cycles (A owes B, B owes C,
+    * C owes A) therefore never form in the ledger: each transfer already nets against the payer's
+    * and payee's balances, which is multilateral clearing performed continuously. Credit supply
+    * falls only when an account with a negative balance receives tokens.
     */
 
    CONTRACT rainbows : public contract {
@@ -157,6 +165,127 @@ using namespace eosio;
                               const string& ref_currency,
                               const string& memo );
 
+         /**
+          * Allows `issuer` account to put a token in lazy demurrage mode, in which every
+          * balance decays continuously at `ppm_per_week` without any per-account action.
+          * The config keeps a global decay index which grows with time; balances are
+          * stored in index-normalized units and converted whenever they are touched,
+          * so reads through the `balance` action return the decayed amount. The stat row
+          * also keeps the normalized sum of all balances, so the decayed supply is known
+          * exactly; `supply` is refreshed from it whenever tokens are issued or retired,
+          * and the `max_supply` check uses the decayed value.
+          * A zero rate turns the mode off.
+          *
+          * @param symbolcode - the token symbol
+          * @param ppm_per_week - the decay rate in ppm per week (at most max_decay_ppm_per_week)
+          *
+          * @pre Transaction must have the issuer authority
+          * @pre The token supply must be zero, so no balance needs converting
+          * @pre The token may not have backings or a credit limit, and may not be garnered
+          */
+         ACTION setdecay( const symbol_code& symbolcode, const int64_t& ppm_per_week );
+
+         /**
+          * Allows `issuer` account to turn on or off limit profiles for a token. With
+          * profiles on, the membership tier, credit limit and positive limit of an account
+          * are kept together in one `profiles` row (scoped on the account), so a transfer
+          * answers all its membership and limit checks with one lookup per party.
+          * Profile rows are refreshed whenever a sister token balance changes, which happens
+          * only for frozen sister tokens; accounts without a current profile row fall back
+          * to reading the sister token balances. Turning profiles on starts a new profile
+          * epoch, so rows left over from an earlier period with profiles on are ignored
+          * until they are refreshed.
+          *
+          * @param symbolcode - the token symbol
+          * @param enable - true to use profiles, false to stop using them
+          *
+          * @pre Transaction must have the issuer authority
+          * @pre Token configuration must not be locked
+          */
+         ACTION setprofiles( const symbol_code& symbolcode, const bool& enable );
+
+         /**
+          * Builds or refreshes the limit profile of `owner` for token `symbolcode` from
+          * the current sister token balances, e.g. for holders whose sister balances
+          * were set before profiles were turned on.
+          *
+          * @param owner - the account whose profile is refreshed
+          * @param symbolcode - the token symbol
+          * @param ram_payer - the account that supports the cost of a new profile row
+          *
+          * @pre Transaction must have the ram_payer authority
+          * @pre The token must use profiles
+          */
+         ACTION syncprofile( const name& owner, const symbol_code& symbolcode, const name& ram_payer );
+
+         /**
+          * Allows `issuer` account to switch a token between standard and compact balance
+          * storage. In compact mode a balance row holds only the bare amount (the token
+          * is already identified by the row key), which saves 8 of the 124 RAM bytes a
+          * standard `accounts` row costs per holder. Compact balances are not visible
+          * in the `accounts` table; wallets read them through the read-only `balance`
+          * action. Balances are read only from the table of the current mode, so
+          * zero rows left in the other table do not shadow them.
+          *
+          * @param symbolcode - the token symbol
+          * @param enable - true for compact storage, false for standard storage
+          *
+          * @pre Transaction must have the issuer authority
+          * @pre The token supply must be zero, so no balance needs converting
+          * @pre The token may not be frozen, since frozen tokens serve as sister tokens
+          */
+         ACTION setcompact( const symbol_code& symbolcode, const bool& enable );
+
+         /**
+          * Reports the balance of `owner` in token `symbolcode` in either storage mode,
+          * with any lazy demurrage applied. The static `get_balance` only reads the
+          * `accounts` table, as for any eosio.token contract, so for decaying tokens
+          * it returns stored (normalized) units.
+          *
+          * @param owner - the account
+          * @param symbolcode - the token symbol
+          *
+          * @return - the balance (an empty asset if the account holds no row)
+          */
+         [[eosio::action, eosio::read_only]] asset balance( const name& owner, const symbol_code& symbolcode );
+
+         /**
+          * Allows `issuer` account to keep balance checkpoints for a token, e.g. for
+          * vote weighting at a past time. Every balance change writes the new balance
+          * into a `checkpoints` row of the account keyed at the end of the current
+          * epoch, so an account gets at most one row per epoch and a change only takes
+          * effect in the history from the next epoch boundary. The first change also
+          * records the balance held since checkpoints were turned on. Once on,
+          * checkpoints cannot be turned off, which would leave gaps in the history;
+          * the epoch length may be changed. Rows are billed to the account authorizing
+          * the balance change.
+          *
+          * @param symbolcode - the token symbol
+          * @param epoch_sec - the epoch length in seconds (nonzero)
+          *
+          * @pre Transaction must have the issuer authority
+          * @pre Token configuration must not be locked
+          * @pre The token may not have lazy demurrage
+          */
+         ACTION setcheckpts( const symbol_code& symbolcode, const uint32_t& epoch_sec );
+
+         /**
+          * Reports the balance of `owner` in token `symbolcode` at time `at`, found by
+          * binary search of the account's checkpoints. The result is the balance held
+          * at the last epoch boundary at or before `at` (or when checkpoints were turned
+          * on, if later); changes within the epoch containing `at` are not counted, so
+          * tokens acquired after a snapshot time never count at that time.
+          *
+          * @param owner - the account
+          * @param symbolcode - the token symbol
+          * @param at - the time of interest (not before checkpoints were turned on)
+          *
+          * @return - the balance at that time
+          */
+         [[eosio::action, eosio::read_only]] asset balanceat( const name& owner,
+                                                              const symbol_code& symbolcode,
+                                                              const time_point_sec& at );
+
         /**
           * Read the valuation (in the configured ref_currency) for a specified
           * quantity of tokens, based on the config parameters submitted in an
@@ -176,6 +305,47 @@ using namespace eosio;
            return rv;
          }
 
+         struct valuation_micro_t { string currency; int64_t value_micro; };
+
+        /**
+          * Read the valuations (in each token's configured ref_currency) of several
+          * quantities of tokens in one call, e.g. for a wallet portfolio.
+          * Values are computed in integer fixed-point: the configured valuation per
+          * token is rounded to millionths, and each value is reported in millionths of
+          * the reference currency, rounded half away from zero.
+          * Tokens without a valuation report an empty currency and zero value.
+          *
+          * @param amounts - the quantities of tokens, at most max_batch_count
+          *
+          * @return - for each amount, in order, the ref_currency designator and the value
+          *           in millionths of that currency
+          *
+          * @pre Each amount must have the token's symbol precision
+          */
+         [[eosio::action, eosio::read_only]] std::vector<valuation_micro_t> valuations(
+              const std::vector<asset>& amounts );
+
+        /**
+          * Previews the backing transfers which an `issue` (by the token issuer) or a
+          * `retire` with redemption (by `owner`) of `quantity` would make, without
+          * executing anything. Transfers are reported as they would be sent, i.e. one
+          * per (backing contract, escrow, symbol). If the action would fail, e.g. on
+          * the reserve_fraction check, the failing constraint is reported instead.
+          *
+          * @param action_name - `issue` or `retire`
+          * @param owner - the retiring account (ignored for `issue`)
+          * @param quantity - the quantity of tokens to issue or retire
+          *
+          * @return - an error message (empty if the action would succeed) and the list of
+          *           backing transfers
+          */
+         struct backing_transfer_t { name contract; name from; name to; asset quantity; };
+         struct preview_t { string error; std::vector<backing_transfer_t> transfers; };
+
+         [[eosio::action, eosio::read_only]] preview_t preview( const name& action_name,
+                                                                const name& owner,
+                                                                const asset& quantity );
+
          /**
           * Allows `issuer` account to create a backing relationship for a token. A new row in the
           * backings table for token symbol scope gets created with the specified characteristics.
@@ -224,7 +394,14 @@ using namespace eosio;
          /**
           * Allows `issuer` account to create or update display metadata for a token.
           * Issuer pays for RAM.
-          * The currency_display table is intended for apps to access (e.g. via nodeos chain API).
+          * Metadata is stored once per sha256 content hash in the reference-counted
+          * `metablobs` table, and the currency_display row holds only the hash, so tokens
+          * with identical metadata share one copy. Apps read it with the `metadata` action.
+          * A copy is always billed to the issuer of the token that most recently began
+          * displaying it, so sharing metadata costs the sharer the RAM of the copy. When
+          * that token releases the copy while others still display it, the bill passes
+          * to the issuer of the latest remaining one, whose authority the releasing
+          * transaction must then carry.
           *
           * @param symbolcode - the token,
           * @param json_meta - json string of metadata. Minimum expected fields are
@@ -255,6 +432,30 @@ using namespace eosio;
           */
          ACTION issue( const asset& quantity, const string& memo );
 
+         /**
+          *  This action issues tokens directly to a list of recipients (e.g. an airdrop),
+          *  equivalent to an `issue` of the total followed by a transfer from the issuer
+          *  to each recipient. Backing tokens for the total are transferred to escrow once
+          *  and the supply is updated once. A zero amount only creates the recipient's
+          *  balance row, like `open`. Recipients are notified as with `transfer`.
+          *
+          * @param symbolcode - the token symbol,
+          * @param recipients - (account, amount) pairs, amounts in the token's smallest
+          *   units; at most max_batch_count entries
+          * @memo - the memo string that accompanies the action.
+          *
+          * @pre The `approve` action must have been executed for this token symbol
+          * @pre Transaction must have the issuer authority
+          * @pre If configured with a membership_symbol in `create` operation, the issuer
+          *   and every recipient other than the issuer must be members, and a visitor
+          *   issuer may not issue to a visitor
+          * @pre If configured with positive_limit_symbol in `create` operation, no
+          *   recipient may be put over its maximum limit
+          */
+         ACTION issuemany( const symbol_code& symbolcode,
+                           const std::vector<std::pair<name,int64_t>>& recipients,
+                           const string& memo );
+
          /**
           * The opposite for issue action, if all validations succeed,
           * it debits the statstable.supply amount. If `do_redeem` flag is true,
@@ -298,7 +499,84 @@ using namespace eosio;
                           const name&    to,
                           const asset&   quantity,
                           const string&  memo );
-         
+
+         /**
+          * Allows `from` account to transfer tokens to several accounts in one action,
+          * with the same checks and notifications as a `transfer` to each of them.
+          * The sender is authorized, checked and debited once, for the total; membership
+          * and positive limit checks are applied to each recipient.
+          *
+          * @param from - the account to transfer from,
+          * @param symbolcode - the token symbol,
+          * @param recipients - (account, amount) pairs, amounts in the token's smallest
+          *   units; at most max_batch_count entries
+          * @param memo - the memo string to accompany the transaction.
+          *
+          * @pre The transfers_frozen flag in the configs table must be false, except for
+          *   transfers from the issuer
+          * @pre If configured with a membership_symbol in `create` operation, the sender and
+          *   each receiver must be members, and at least one of each pair must be a regular member
+          * @pre The `from` account balance must be sufficient for the total (allowing for
+          *   credit if configured with credit_limit_symbol in `create` operation)
+          * @pre If configured with positive_limit_symbol in `create` operation, no transfer
+          *   may put its receiver over its maximum limit
+          */
+         ACTION transfermany( const name&        from,
+                              const symbol_code& symbolcode,
+                              const std::vector<std::pair<name,int64_t>>& recipients,
+                              const string&      memo );
+
+         /**
+          * Allows `sender` account to open a payment stream to `recipient`, which accrues
+          * `rate` every `period_sec` seconds between `start` and `stop`. Nothing moves
+          * until the stream is claimed or closed; the accrued amount is then computed
+          * and settled as one transfer, subject to the same frozen, membership and
+          * limit checks as `transfer`. Tokens are not escrowed: the sender balance
+          * (allowing for credit) must cover the amount at settlement, except when the
+          * recipient closes the stream (see `closestream`).
+          *
+          * @param sender - the paying account
+          * @param recipient - the receiving account
+          * @param rate - the amount accrued per period
+          * @param period_sec - the period length in seconds
+          * @param start - the time accrual begins (not in the past)
+          * @param stop - the time accrual ends
+          * @param memo - the memo string to accompany the transaction
+          *
+          * @pre Transaction must have the sender authority
+          */
+         ACTION openstream( const name&           sender,
+                            const name&           recipient,
+                            const asset&          rate,
+                            const uint32_t&       period_sec,
+                            const time_point_sec& start,
+                            const time_point_sec& stop,
+                            const string&         memo );
+
+         /**
+          * Settles the amount accrued on a payment stream since its last settlement.
+          *
+          * @param symbolcode - the token symbol
+          * @param id - the stream id
+          *
+          * @pre Transaction must have the recipient authority
+          */
+         ACTION claimstream( const symbol_code& symbolcode, const uint64_t& id );
+
+         /**
+          * Settles the amount accrued on a payment stream and removes the stream.
+          * When the sender closes it, the whole accrued amount must be paid. When the
+          * recipient closes it, the payout is limited to what the sender can pay and
+          * the recipient can receive at that moment (possibly nothing), and the rest
+          * is forgone, so a stream whose sender cannot pay can still be removed.
+          *
+          * @param symbolcode - the token symbol
+          * @param id - the stream id
+          *
+          * @pre Transaction must have the sender or recipient authority
+          */
+         ACTION closestream( const symbol_code& symbolcode, const uint64_t& id );
+
          /**
           * Allows `from` account to transfer to `to` account a fraction of its balance.
           * One account is debited and the other is credited.
@@ -336,6 +614,28 @@ using namespace eosio;
                         const int64_t&     ppm_abs,
                         const string&      memo );
          
+         /**
+          * Applies `garner` demurrage to many holders of a token in one action.
+          * Holders are visited stalest-first, i.e. in order of their last garner time,
+          * and at most `limit` holders are visited. Each visited holder with a positive
+          * balance is debited directly; the total is credited to the `withdraw_to`
+          * account in a single balance update. Repeated calls therefore sweep all
+          * holders, each call costing at most `limit` row updates.
+          * Only holders registered by a previous `garner` or `garnerall` are visited; a
+          * visited holder's garner date is reset even if nothing is withdrawn.
+          *
+          * @param symbolcode - the token symbol,
+          * @param ppm_per_week - the demurrage rate in ppm per week,
+          * @param limit - max number of holders to visit (1..max_garner_batch).
+          *
+          * @pre the transaction must be authorized by the withrawal_mgr account
+          * @pre If configured with positive_limit_symbol in `create` operation, the total
+          *   must not put the `withdraw_to` account over its maximum limit
+          */
+         ACTION garnerall( const symbol_code& symbolcode,
+                           const int64_t&     ppm_per_week,
+                           const uint32_t&    limit );
+         
          /**
           * Allows `ram_payer` to create an account `owner` with zero balance for
           * token `symbolcode` at the expense of `ram_payer`.
@@ -391,7 +691,7 @@ using namespace eosio;
 
          /**
           * This action clears the `accounts` table for a particular account. All
-          * token balances in the account are erased.
+          * token balances, limit profiles and checkpoints in the account are erased.
           *
           * @param account - account
           *
@@ -399,6 +699,39 @@ using namespace eosio;
           */
          ACTION resetacct( const name& account );
 
+         struct gc_report {
+            uint32_t accounts_erased;
+            uint32_t garnerdates_erased;
+            int64_t  ram_bytes_freed; // estimate from the erased rows' serialized sizes
+            name     next;
+         };
+
+         /**
+          * Reclaims RAM held by rows that no longer carry information for token
+          * `symbolcode`: zero-balance `accounts` rows and `garnerdates` rows of accounts
+          * without a balance. The action visits at most `limit` accounts, either those
+          * listed in `owners` or, if `owners` is empty, the `garnerdates` rows from
+          * `cursor` on, so large communities can be swept in bounded steps.
+          * Zero-balance rows of frozen tokens are kept, because such a row in a sister
+          * token (e.g. a zero positive limit) is not the same as a missing row.
+          *
+          * @param symbolcode - the token symbol
+          * @param cursor - the first garnerdates account to visit (empty: from the start)
+          * @param limit - max number of accounts visited (1..max_batch_count)
+          * @param owners - accounts to visit instead of walking garnerdates (may be empty)
+          *
+          * @return - rows erased, RAM bytes freed, and the cursor for the next call
+          *           (empty when the walk is complete). The byte count is an estimate
+          *           computed from the contract's assumed per-row and per-index overheads,
+          *           not a figure reported by the chain.
+          *
+          * @pre Transaction must have the issuer authority
+          */
+         [[eosio::action]] gc_report gc( const symbol_code& symbolcode, const name& cursor,
+                                         const uint32_t& limit, const std::vector<name>& owners );
+
+         // reads the `accounts` table only: for a compact or decaying rainbows token it
+         // returns the stored row, not the live balance reported by the `balance` action
          static asset get_balance( const name& token_contract_account, const name& owner, const symbol_code& sym_code )
          {
             accounts accountstable( token_contract_account, owner.value );
@@ -422,10 +755,22 @@ using namespace eosio;
 
       private:
          const int max_backings_count = 8; // don't use too much cpu time to complete transaction
+         const uint32_t max_garner_batch = 500; // holders visited by one `garnerall`
+         const uint32_t max_batch_count = 200; // entries in one multi-account action
+         // keeps the decay index below ~2^20 over 50 years, so normalized balances fit int64
+         const int64_t max_decay_ppm_per_week = 5000;
          const uint64_t no_index = static_cast<uint64_t>(-1); // flag for nonexistent defer_table link
          static const asset null_asset;
          const uint32_t VISITOR = 1;
          const uint32_t REGULAR = 2;
+         // roles of a sister token in the tokens that depend on it
+         static const uint8_t MEMBERSHIP_ROLE = 1;
+         static const uint8_t CRED_LIMIT_ROLE = 2;
+         static const uint8_t POS_LIMIT_ROLE = 4;
+         // chain RAM billing per row: fixed multi_index overhead plus payload,
+         // and each uint64 secondary index row adds its own overhead
+         static const int64_t ROW_OVERHEAD = 108;
+         static const int64_t INDEX64_OVERHEAD = 128;
 
          TABLE account { // scoped on account name
             asset    balance;
@@ -437,6 +782,8 @@ using namespace eosio;
             asset    supply;
             asset    max_supply;
             name     issuer;
+            binary_extension<int64_t>
+                     decay_supply; // sum of balances in decay-normalized units, see `setdecay`
 
             uint64_t primary_key()const { return supply.symbol.code().raw(); }
          };
@@ -460,11 +807,46 @@ using namespace eosio;
                         val_per_token;
             binary_extension<string>
                         ref_currency;
+            binary_extension<int64_t>
+                        decay_ppm_per_week; // lazy demurrage rate, see `setdecay`
+            binary_extension<time_point>
+                        decay_since; // time at which the decay index was 1
+            binary_extension<bool>
+                        use_profiles; // limits read from `profiles` rows, see `setprofiles`
+            binary_extension<bool>
+                        compact_balances; // bare amounts in `cbalances`, see `setcompact`
+            binary_extension<uint32_t>
+                        checkpoint_sec; // balance checkpoint epoch, see `setcheckpts`
+            binary_extension<time_point>
+                        checkpoint_since; // time at which checkpoints were turned on
+            binary_extension<uint32_t>
+                        profile_epoch; // bumped when profiles are turned on; older rows are stale
          };
 
          TABLE currency_display {  // singleton, scoped on token symbol code
-            string     json_meta;
+            string     json_meta; // empty when stored in `metablobs`
+            binary_extension<checksum256>
+                       meta_hash; // key of the shared metadata in `metablobs`
+         };
+
+         TABLE metablob { // scoped on get_self()
+            uint64_t    id; // leading bytes of the hash
+            checksum256 hash;
+            string      json_meta;
+            std::vector<symbol_code>
+                        users; // tokens displaying this metadata; the last one's issuer pays
+
+            uint64_t primary_key()const { return id; };
          };
+         static uint64_t meta_key( const checksum256& hash )
+         {
+            auto bytes = hash.extract_as_byte_array();
+            uint64_t key = 0;
+            for( int i = 0; i < 8; ++i ) {
+               key = key<<8 | bytes[i];
+            }
+            return key;
+         }
 
 
          TABLE backing_stats {  // scoped on token symbol code
@@ -485,8 +867,11 @@ using namespace eosio;
 
          TABLE symbolt { // scoped on get_self()
             symbol_code  symbolcode;
+            binary_extension<name>
+                         issuer; // absent in rows written before the `byissuer` index
 
             uint64_t primary_key()const { return symbolcode.raw(); };
+            uint128_t by_issuer()const { return (uint128_t)issuer.value_or().value<<64 | symbolcode.raw(); };
          };
 
          TABLE garner_dates { // scoped on symbolcode
@@ -494,31 +879,317 @@ using namespace eosio;
             time_point last_garner;
 
             uint64_t primary_key()const { return account.value; };
+            uint64_t by_last_garner()const { return last_garner.time_since_epoch().count(); };
+         };
+
+         TABLE profile { // scoped on account name
+            symbol_code token;
+            int64_t     membership;     // sister token balances, in token precision
+            int64_t     cred_limit;
+            int64_t     positive_limit;
+            binary_extension<uint32_t>
+                        epoch; // token's `profile_epoch` when the row was written
+
+            uint64_t primary_key()const { return token.raw(); };
+         };
+
+         TABLE sister { // scoped on sister token symbol code
+            symbol_code token; // a token using this sister token with profiles on
+            uint8_t     roles;
+
+            uint64_t primary_key()const { return token.raw(); };
          };
 
          typedef eosio::multi_index< "accounts"_n, account > accounts;
+         typedef eosio::multi_index< "profiles"_n, profile > profiles;
+         typedef eosio::multi_index< "sisters"_n, sister > sisters;
          typedef eosio::multi_index< "stat"_n, currency_stats > stats;
          typedef eosio::singleton< "configs"_n, currency_config > configs;
          typedef eosio::multi_index< "configs"_n, currency_config >  dump_for_config;
          typedef eosio::singleton< "displays"_n, currency_display > displays;
          typedef eosio::multi_index< "displays"_n, currency_display >  dump_for_display;
+         typedef eosio::multi_index< "metablobs"_n, metablob > metablobs;
          typedef eosio::multi_index< "backings"_n, backing_stats, indexed_by
                < "backingtoken"_n,
                  const_mem_fun<backing_stats, uint128_t, &backing_stats::by_secondary >
                >
             > backs;
-         typedef eosio::multi_index< "symbols"_n, symbolt > symbols;
+         typedef eosio::multi_index< "symbols"_n, symbolt, indexed_by
+               < "byissuer"_n,
+                 const_mem_fun<symbolt, uint128_t, &symbolt::by_issuer >
+               >
+            > symbols;
          symbols symboltable;
-         typedef eosio::multi_index< "garnerdates"_n, garner_dates > garnerdates;
+         typedef eosio::multi_index< "garnerdates"_n, garner_dates, indexed_by
+               < "bylastgarner"_n,
+                 const_mem_fun<garner_dates, uint64_t, &garner_dates::by_last_garner >
+               >
+            > garnerdates;
+
+         TABLE checkpoint { // scoped on account name
+            uint64_t       id;
+            symbol_code    token;
+            time_point_sec at;      // start of the epoch of the last recorded change
+            int64_t        balance; // balance after that change
+
+            uint64_t primary_key()const { return id; };
+            uint128_t by_token_time()const { return checkpoint_key( token, at ); };
+         };
+         static uint128_t checkpoint_key( const symbol_code& token, const time_point_sec& at )
+         {
+            return (uint128_t)token.raw()<<64 | at.sec_since_epoch();
+         }
+
+         TABLE stream { // scoped on token symbol code
+            uint64_t       id;
+            name           sender;
+            name           recipient;
+            asset          rate;       // amount accrued per period
+            uint32_t       period_sec;
+            time_point_sec start;
+            time_point_sec stop;
+            int64_t        paid;       // amount settled so far
+
+            uint64_t primary_key()const { return id; };
+         };
+         // amount accrued on a stream from its start up to `now`
+         static int64_t stream_accrued( const stream& sm, const time_point_sec& now )
+         {
+            if( now <= sm.start ) {
+               return 0;
+            }
+            uint32_t elapsed = std::min( now, sm.stop ).sec_since_epoch() - sm.start.sec_since_epoch();
+            return (int128_t)sm.rate.amount*elapsed/sm.period_sec;
+         }
+
+         typedef eosio::multi_index< "streams"_n, stream > streams;
+         typedef eosio::multi_index< "checkpoints"_n, checkpoint, indexed_by
+               < "bytokentime"_n,
+                 const_mem_fun<checkpoint, uint128_t, &checkpoint::by_token_time >
+               >
+            > checkpoints;
+
+         // compact-mode balance rows hold a bare int64 amount, keyed by symbol code
+         // in the owner scope; they are written through the raw db api because a
+         // multi_index row would have to repeat its primary key in the payload
+         static constexpr name compact_table = "cbalances"_n;
+
+         // the balance row of one owner and token in either storage mode, found once
+         class balance_row {
+          public:
+            balance_row( const name& self, const name& owner, const symbol& sym, bool compact );
+            bool exists() const { return compact ? citr >= 0 : it != acnts.end(); }
+            int64_t amount() const { return compact ? camount : ( exists() ? it->balance.amount : 0 ); }
+            void set( int64_t amount, const name& ram_payer ); // ram_payer pays for a new row only
+            void erase();
+          private:
+            name     self;
+            name     owner;
+            symbol   sym;
+            bool     compact;
+            accounts acnts;
+            accounts::const_iterator it;
+            int32_t  citr;
+            int64_t  camount;
+         };
+
+      public:
+         struct token_info {
+            symbol_code                symbolcode;
+            currency_stats             stat;
+            currency_config            config;
+            string                     json_meta;
+            std::vector<backing_stats> backings;
+         };
+         struct token_page {
+            std::vector<token_info>    tokens;
+            symbol_code                next; // cursor for the following page; empty when done
+         };
+
+         /**
+          * Reports the stat, config, display metadata and backings of several tokens
+          * in one read-only call, e.g. for a token list UI.
+          * Tokens are reported in symbol order, or, if `issuer` is given, only the tokens
+          * of that issuer in symbol order.
+          *
+          * @param cursor - the first symbol to report (empty: from the start)
+          * @param limit - max number of tokens to report (1..max_token_page)
+          * @param issuer - report only tokens of this issuer (empty name: all tokens)
+          *
+          * @return - one page of token reports and the cursor for the next page
+          */
+         [[eosio::action, eosio::read_only]] token_page tokens( const symbol_code& cursor,
+                                                                const uint32_t& limit,
+                                                                const name& issuer );
+
+         struct solvency_t {
+            symbol_code token;
+            uint64_t    backing_index;
+            name        escrow;
+            bool        proportional;     // redeemed pro rata from escrow
+            uint32_t    reserve_fraction; // required reserve, in percent
+            asset       escrow_balance;   // shared by all backings using this escrow
+            asset       liability;        // token supply at backs_per_bucket
+            asset       escrow_liability; // summed liability of all backings using the escrow
+            int64_t     reserve_ppm;      // escrow_balance / escrow_liability; 0 when none
+         };
+         struct solvency_page {
+            std::vector<solvency_t>    backings;
+            symbol_code                next; // cursor for the following page; empty when done
+         };
+
+         /**
+          * Reports escrow solvency of every token backed by one backing token, e.g.
+          * SEEDS on token.seeds, in one read-only call. For each visited token the
+          * backings with that backing token are found through the `backingtoken`
+          * index, and each is reported with its escrow balance, the liability of the
+          * token supply at `backs_per_bucket`, and the reserve ratio of the escrow.
+          * An escrow may back several tokens, so the ratio divides its balance by the
+          * liability summed over every token's backings that use it, not only those in
+          * the page. That sum costs one index lookup per token, once per page.
+          *
+          * @param backing_contract - the backing token contract
+          * @param backing_symbol - the backing token symbol
+          * @param cursor - the first token symbol to visit (empty: from the start)
+          * @param limit - max number of tokens visited (1..max_token_page)
+          *
+          * @return - one page of backing reports and the cursor for the next page
+          */
+         [[eosio::action, eosio::read_only]] solvency_page solvency( const name& backing_contract,
+                                                                     const symbol& backing_symbol,
+                                                                     const symbol_code& cursor,
+                                                                     const uint32_t& limit );
+
+         struct token_meta_t { symbol_code token; checksum256 hash; };
+         struct meta_t { checksum256 hash; string json_meta; };
+         struct metadata_page {
+            std::vector<token_meta_t>  tokens; // the metadata hash of each token found
+            std::vector<meta_t>        metas;  // each distinct metadata once
+         };
 
-         void sub_balance( const name& owner, const asset& value, const symbol_code& limit_symbol );
-         void add_balance( const name& owner, const asset& value, const name& ram_payer,
-                           const symbol_code& limit_symbol );
+         /**
+          * Reports the display metadata of several tokens in one read-only call.
+          * Each distinct metadata is reported once, so the response scales with
+          * the number of distinct metadata rather than the number of tokens.
+          *
+          * @param symbolcodes - the tokens (at most max_token_page); unknown ones are skipped
+          *
+          * @return - the metadata hash per token and the metadata per hash
+          */
+         [[eosio::action, eosio::read_only]] metadata_page metadata(
+                                                   const std::vector<symbol_code>& symbolcodes );
+
+      private:
+         const uint32_t max_token_page = 50; // tokens reported by one read-only page
+
+         // balance of one of this contract's tokens in either storage mode, decayed
+         asset token_balance( const name& owner, const symbol_code& sym_code );
+         // balance on any token contract; routes this contract's own tokens to token_balance
+         asset held_balance( const name& token_contract_account, const name& owner,
+                             const symbol_code& sym_code );
+
+         // display metadata of a token, in either storage form
+         string display_meta( const currency_display& dt );
+         checksum256 display_hash( const currency_display& dt );
+         // drops the token's reference to shared metadata, erasing it when unused
+         void release_meta( const symbol_code& token, const currency_display& dt );
+
+         // growth of the lazy demurrage index since `decay_since`; 1.0 when not decaying
+         static double decay_index( const currency_config& cf )
+         {
+            if( !cf.decay_ppm_per_week.has_value() || cf.decay_ppm_per_week.value() == 0 ) {
+               return 1.0;
+            }
+            const double secs_per_week = 7*24*60*60;
+            double weeks = (current_time_point() - cf.decay_since.value()).to_seconds() / secs_per_week;
+            return exp( -log( 1.0 - cf.decay_ppm_per_week.value() / 1000000.0 ) * weeks );
+         }
+         static int64_t to_decay_units( int64_t amount, double index )
+         {
+            return index == 1.0 ? amount : (int64_t)llround( amount * index );
+         }
+         static int64_t from_decay_units( int64_t stored, double index )
+         {
+            return index == 1.0 ? stored : (int64_t)floor( stored / index );
+         }
+         // supply net of lazy demurrage
+         static int64_t live_supply( const currency_stats& st, double index )
+         {
+            if( !st.decay_supply.has_value() ) {
+               return st.supply.amount;
+            }
+            return from_decay_units( st.decay_supply.value(), index );
+         }
+         // applies a change in normalized balances to a decaying token's supply
+         static void add_decay_supply( currency_stats& s, int64_t stored_delta, double index )
+         {
+            if( s.decay_supply.has_value() ) {
+               s.decay_supply = std::max<int64_t>( s.decay_supply.value() + stored_delta, 0 );
+               s.supply.amount = from_decay_units( s.decay_supply.value(), index );
+            }
+         }
+
+         // how a token's balances are stored, read once from its config per action
+         struct balance_mode {
+            double         index = 1.0;        // lazy demurrage index
+            bool           compact = false;    // bare int64 balance rows
+            uint32_t       checkpoint_sec = 0; // checkpoint epoch; 0 when not kept
+            time_point_sec checkpoint_since;
+         };
+         balance_mode mode_of( const currency_config& cf );
+         // balance updates return the resulting change in outstanding credit;
+         // the caller applies it to the stat row
+         int64_t sub_balance( const name& owner, const asset& value, const name& ram_payer,
+                              int64_t limit, const balance_mode& mode );
+         // as above, debiting `stored_value` normalized units for `value`
+         int64_t sub_balance( const name& owner, const asset& value, const name& ram_payer,
+                              int64_t limit, const balance_mode& mode, int64_t stored_value );
+         int64_t add_balance( const name& owner, const asset& value, const name& ram_payer,
+                              int64_t limit, const balance_mode& mode );
+         void record_checkpoint( const name& owner, const symbol_code& token, int64_t old_amount,
+                                 int64_t new_amount, const balance_mode& mode, const name& ram_payer );
+         // pays what a stream has accrued since its last settlement; returns the amount paid
+         // (with `partial`, only what the sender can pay now, and nothing if the
+         // transfer checks fail, instead of aborting)
+         int64_t settle_stream( const stream& sm, bool partial = false );
+         // membership tier and limits of one account; defaults when a sister token is unset
+         struct account_limits {
+            int64_t membership;
+            int64_t cred_limit;
+            int64_t positive_limit;
+         };
+         account_limits read_limits( const name& owner, const symbol& sym, const currency_config& cf );
+         void sync_profiles( const symbol_code& sister, const name& owner, const name& ram_payer );
+         void refresh_profile( const name& owner, const symbol_code& token, const name& ram_payer );
+         // removes `token` from the dependents of each of its sister tokens
+         void drop_sisters( const symbol_code& token, const currency_config& cf );
+         bool is_decaying( const currency_config& cf ) {
+            return cf.decay_ppm_per_week.has_value() && cf.decay_ppm_per_week.value() != 0;
+         }
+         bool is_compact( const currency_config& cf ) {
+            return cf.compact_balances.value_or( false );
+         }
          void sister_check(const string& sym_name, uint32_t precision);
+         // backing transfer for one (contract, escrow, symbol) group
+         struct backing_leg {
+            name     contract;
+            name     escrow;
+            asset    quantity;
+            bool     proportional; // all grouped backings are proportional
+         };
          void set_all_backings( const name& owner, const asset& quantity );
-         void redeem_all_backings( const name& owner, const asset& quantity );
+         void redeem_all_backings( const name& owner, const asset& quantity, const asset& supply );
          void set_one_backing( const backing_stats& bk, const name& owner, const asset& quantity );
-         void redeem_one_backing( const backing_stats& bk, const name& owner, const asset& quantity );
+         void redeem_one_backing( const backing_stats& bk, const name& owner,
+                                  const asset& quantity, const asset& supply );
+         asset backing_for( const backing_stats& bk, const asset& quantity );
+         string redemption_for( const backing_stats& bk, const asset& quantity,
+                                int64_t supply, int64_t backing_in_escrow, asset& backing_quantity );
+         void issue_legs( const asset& quantity, std::vector<backing_leg>& legs );
+         string redeem_legs( const asset& quantity, const asset& supply, std::vector<backing_leg>& legs );
+         void add_backing_leg( std::vector<backing_leg>& legs, const backing_stats& bk,
+                               const asset& backing_quantity, bool proportional );
+         void send_backing_legs( const std::vector<backing_leg>& legs, const name& owner, bool to_escrow );
          void reset_one( const symbol_code symbolcode, const bool all, const uint32_t limit, uint32_t& counter );
  
    };